@@ -0,0 +1,105 @@
+// Cost of checking one program against one minute:
+//   before     the match as it was before TimeContext, which breaks the
+//              time down again for each hour(), minute(), weekday(),
+//              day() and month() call
+//   time_t     ProgramStruct::check_match(time_t), one breakTime() per call
+//   context    one TimeContext per minute, shared by all the programs
+// All three must agree on every match.
+//
+//   bench_match [days]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "harness.h"
+
+#define NPROGRAMS 64
+
+// the match as it was before TimeContext
+static byte match_before(ProgramStruct &p, time_t t) {
+  unsigned int current_minute = (unsigned int)hour(t)*60+(unsigned int)minute(t);
+  if (p.enabled == 0) return 0;
+  if ((p.days[0]&0x80)&&(p.days[1]>1)) {
+    byte dn   =p.days[1];
+    byte drem =p.days[0]&0x7f;
+    if (((t/SECS_PER_DAY)%dn) != drem)  return 0;
+  }
+  else {
+    byte wd = ((byte)weekday(t)+5)%7;
+    if (!(p.days[0] & (1<<wd)))
+      return 0;
+    byte dt=day(t);
+    if ((p.days[0]&0x80)&&(p.days[1]==0)) {
+      if((dt%2)!=0)  return 0;
+    }
+    if ((p.days[0]&0x80)&&(p.days[1]==1)) {
+      if(dt==31)  return 0;
+      else if (dt==29 && month(t)==2)  return 0;
+      else if ((dt%2)!=1)  return 0;
+    }
+  }
+  if (current_minute < p.start_time || current_minute > p.end_time)
+    return 0;
+  if (p.interval == 0)  return 0;
+  if (((current_minute - p.start_time) / p.interval) * p.interval ==
+    (current_minute - p.start_time)) {
+    return 1;
+  }
+  return 0;
+}
+
+static ProgramStruct progs[NPROGRAMS];
+
+static void make_programs() {
+  memset(progs, 0, sizeof(progs));
+  for (byte i = 0; i < NPROGRAMS; i++) {
+    ProgramStruct &p = progs[i];
+    p.enabled = 1;
+    p.start_time = (i * 97) % 1440;
+    p.end_time = p.start_time + 240;
+    p.interval = 1 + i % 60;
+    p.duration = 300;
+    switch (i % 4) {
+    case 0: p.days[0] = 0x7f; break;                             // daily
+    case 1: p.days[0] = 0x80 | 0x15; p.days[1] = 0; break;       // Mon/Wed/Fri, even days
+    case 2: p.days[0] = 0x80 | 0x7f; p.days[1] = 1; break;       // odd days
+    case 3: p.days[0] = 0x80 | (i % 3); p.days[1] = 3; break;    // every 3 days
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  int days = argc > 1 ? atoi(argv[1]) : 60;
+  long checks = (long)days * 1440 * NPROGRAMS;
+  long n[3] = {0, 0, 0};
+  double ns[3];
+  unsigned long long t0;
+  make_programs();
+
+  t0 = sim_host_ns();
+  for (time_t t = SIM_EPOCH; t < SIM_EPOCH + (time_t)days * 86400; t += 60)
+    for (byte i = 0; i < NPROGRAMS; i++)  n[0] += match_before(progs[i], t);
+  ns[0] = (double)(sim_host_ns() - t0) / checks;
+
+  t0 = sim_host_ns();
+  for (time_t t = SIM_EPOCH; t < SIM_EPOCH + (time_t)days * 86400; t += 60)
+    for (byte i = 0; i < NPROGRAMS; i++)  n[1] += progs[i].check_match(t);
+  ns[1] = (double)(sim_host_ns() - t0) / checks;
+
+  t0 = sim_host_ns();
+  for (time_t t = SIM_EPOCH; t < SIM_EPOCH + (time_t)days * 86400; t += 60) {
+    TimeContext tc;
+    tc.set(t);
+    for (byte i = 0; i < NPROGRAMS; i++)  n[2] += progs[i].check_match(tc);
+  }
+  ns[2] = (double)(sim_host_ns() - t0) / checks;
+
+  printf("%d programs over %d days, ns per program check:\n", NPROGRAMS, days);
+  printf("  before   %6.1f  (%ld matches)\n", ns[0], n[0]);
+  printf("  time_t   %6.1f  (%ld matches)\n", ns[1], n[1]);
+  printf("  context  %6.1f  (%ld matches)\n", ns[2], n[2]);
+  if (n[0] != n[1] || n[0] != n[2]) {
+    printf("mismatch\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,85 @@
+// Per-minute scheduling cost against the number of programs: the
+// compiled start table (ProgramData::schedule_next) against reading and
+// matching every program each minute, as loop() did before. Both walk
+// the same simulated days; host time and EEPROM bytes read are per
+// minute, and both must find the same starts.
+//
+//   bench_schedule [days]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "harness.h"
+
+static void make_programs(byte n) {
+  pd.erase();
+  for (byte i = 0; i < n; i++) {
+    uint16_t at = (i * 97) % 1440;
+    switch (i % 4) {
+    case 0: sim_add_program(0x7f, 0, at, at, 1, 300, 1 << (i % 8)); break;          // daily
+    case 1: sim_add_program(0x7f, 0, 360 + i % 60, 1200, 30, 120, 1 << (i % 8)); break;  // every 30 minutes
+    case 2: sim_add_program(0x80 | 0x15, 0, at, at, 1, 300, 1 << (i % 8)); break;   // Mon/Wed/Fri, even days
+    case 3: {                                                                        // every 3 days
+      byte days[2] = {(byte)(0x80 | (i % 3)), 3};
+      pd.drem_to_absolute(days);
+      sim_add_program(days[0], days[1], at, at + 240, 60, 300, 1 << (i % 8));
+      break;
+    }
+    }
+  }
+}
+
+struct Result {
+  double ns;        // host time per minute
+  double bytes;     // EEPROM bytes read per minute
+  long starts;
+};
+
+static Result run_compiled(int days) {
+  Result r = {0, 0, 0};
+  long reads = sim_eeprom_reads;
+  unsigned long long t0 = sim_host_ns();
+  for (time_t t = SIM_EPOCH; t < SIM_EPOCH + (time_t)days * 86400; t += 60)
+    while (pd.schedule_next(t) != SCHEDULE_NONE)  r.starts++;
+  r.ns = (double)(sim_host_ns() - t0) / (days * 1440);
+  r.bytes = (double)(sim_eeprom_reads - reads) / (days * 1440);
+  return r;
+}
+
+static Result run_scan(int days) {
+  Result r = {0, 0, 0};
+  ProgramStruct prog;
+  long reads = sim_eeprom_reads;
+  unsigned long long t0 = sim_host_ns();
+  for (time_t t = SIM_EPOCH; t < SIM_EPOCH + (time_t)days * 86400; t += 60) {
+    for (byte pid = 0; pid < pd.nprograms; pid++) {
+      pd.read(pid, &prog);
+      if (prog.check_match(t))  r.starts++;
+    }
+  }
+  r.ns = (double)(sim_host_ns() - t0) / (days * 1440);
+  r.bytes = (double)(sim_eeprom_reads - reads) / (days * 1440);
+  return r;
+}
+
+int main(int argc, char **argv) {
+  int days = argc > 1 ? atoi(argv[1]) : 28;
+  sim_power_on(SIM_EPOCH);
+  byte max = PROGRAM_SLOTS(svc.nboards);
+  byte counts[] = {1, 5, 10, 20, 40, max};
+
+  printf("%d days; per minute:      compiled table          full scan\n", days);
+  printf("programs  starts    ns  EEPROM bytes      ns  EEPROM bytes\n");
+  int status = 0;
+  for (byte i = 0; i < sizeof(counts); i++) {
+    if (counts[i] > max)  continue;
+    make_programs(counts[i]);
+    Result c = run_compiled(days);
+    Result s = run_scan(days);
+    printf("%8d %7ld %5.0f %13.1f %7.0f %13.1f\n", counts[i], c.starts, c.ns, c.bytes, s.ns, s.bytes);
+    if (c.starts != s.starts) {
+      printf("  mismatch: full scan found %ld starts\n", s.starts);
+      status = 1;
+    }
+  }
+  return status;
+}
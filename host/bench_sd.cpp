@@ -0,0 +1,128 @@
+// Throughput of the SD card program store (build with SD_PROGRAM_STORE):
+// adding programs, compiling the start table, the per-minute check over
+// a day and reads through the record cache, in host time and card seeks.
+// The starts found over the day must match a scan of every program
+// with check_match().
+//
+//   bench_sd [programs]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+#include <vector>
+#include "harness.h"
+
+#ifndef SD_PROGRAM_STORE
+#error "bench_sd needs the SD build (-DSD_PROGRAM_STORE)"
+#endif
+
+static double us() {
+  return sim_host_ns() / 1000.0;
+}
+
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : MAX_NUMBER_PROGRAMS;
+  if (n > MAX_NUMBER_PROGRAMS)  n = MAX_NUMBER_PROGRAMS;
+  sim_power_on(SIM_EPOCH);
+  sim_set_option(OPTION_USE_NTP, 0);
+  sim_set_option(OPTION_EXT_BOARDS, 5);
+
+  // random programs, three in four of them starting together at 6:00
+  // so that the table overflows
+  srand(7);
+  ProgramStruct p;
+  double t0 = us();
+  for (int i = 0; i < n; i++) {
+    memset(&p, 0, sizeof(p));
+    p.enabled = 1;
+    p.days[0] = rand() % 3 == 0 ? 0x7f : 1 << (rand() % 7);
+    if (i % 4 != 3) {
+      p.days[0] = 0x7f;
+      p.start_time = p.end_time = 360;
+      p.interval = 1;
+    } else {
+      p.start_time = rand() % 1440;
+      p.end_time = p.start_time + rand() % 300;
+      if (p.end_time > 1439)  p.end_time = 1439;
+      p.interval = 30 + rand() % 200;
+    }
+    p.duration = 60 + i;
+    p.stations[rand() % 6] = 1 << (rand() % 8);
+    pd.add(&p);
+  }
+  double add_us = (us() - t0) / n;
+  pd.init();   // reload the index from the card
+  if (pd.nprograms != n) {
+    printf("reloaded %d programs of %d\n", pd.nprograms, n);
+    return 1;
+  }
+
+  // reference: every program checked every minute of the day
+  time_t day0 = SIM_EPOCH / 86400 * 86400;
+  std::vector<std::pair<int, int> > ref, got;
+  for (int m = 0; m < 1440; m++)
+    for (int pid = 0; pid < pd.nprograms; pid++) {
+      pd.read(pid, &p);
+      if (p.check_match(day0 + m*60))  ref.push_back(std::make_pair(m, pid));
+    }
+
+  // the table is compiled on the first call of the day
+  pd.schedule_next(day0 - 60);
+  long seeks = sim_sd_seeks;
+  t0 = us();
+  byte pid;
+  std::vector<byte> first;
+  while ((pid = pd.schedule_next(day0)) != SCHEDULE_NONE)  first.push_back(pid);
+  double compile_us = us() - t0;
+  long compile_seeks = sim_sd_seeks - seeks;
+
+  // the minute checks, reading each program that starts as loop() does
+  double minutes_us = 0;
+  long max_starts = 0;
+  seeks = sim_sd_seeks;
+  for (int m = 0; m < 1440; m++) {
+    long k = 0;
+    double b = us();
+    if (m == 0) {
+      for (size_t i = 0; i < first.size(); i++, k++) {
+        pd.read(first[i], &p);
+        got.push_back(std::make_pair(0, (int)first[i]));
+      }
+    }
+    while ((pid = pd.schedule_next(day0 + m*60)) != SCHEDULE_NONE) {
+      pd.read(pid, &p);
+      got.push_back(std::make_pair(m, (int)pid));
+      k++;
+    }
+    minutes_us += us() - b;
+    if (k > max_starts)  max_starts = k;
+  }
+  long day_seeks = sim_sd_seeks - seeks;
+
+  // reads through the cache
+  const int R = 100000;
+  seeks = sim_sd_seeks;
+  t0 = us();
+  for (int i = 0; i < R; i++)  pd.read(rand() % pd.nprograms, &p);
+  double random_us = (us() - t0) / R;
+  double random_seeks = (double)(sim_sd_seeks - seeks) / R;
+  seeks = sim_sd_seeks;
+  t0 = us();
+  for (int i = 0; i < R; i++)  pd.read(i % SD_CACHE_RECORDS, &p);
+  double hot_us = (us() - t0) / R;
+  double hot_seeks = (double)(sim_sd_seeks - seeks) / R;
+
+  printf("%d programs on SD, schedule table of %d\n", n, SCHEDULE_SIZE);
+  printf("  add:         %.1f us per program\n", add_us);
+  printf("  first check of the day: %.0f us, %ld seeks\n", compile_us, compile_seeks);
+  printf("  day of minute checks: %.0f us, %ld seeks, %zu starts, at most %ld in a minute\n",
+         minutes_us, day_seeks, got.size(), max_starts);
+  printf("  random read: %.2f us, %.2f seeks\n", random_us, random_seeks);
+  printf("  cached read: %.2f us, %.3f seeks\n", hot_us, hot_seeks);
+  if (ref != got) {
+    printf("starts differ from a full scan: %zu expected, %zu found\n", ref.size(), got.size());
+    return 1;
+  }
+  printf("  starts match a full scan\n");
+  return 0;
+}
@@ -0,0 +1,76 @@
+// Latency of loop() while a client sends its request slowly: the
+// request arrives 'chunk' bytes at a time, one piece every 'gap' passes
+// of 1 ms. For each case this reports the longest single loop() pass,
+// in virtual time (delay() and EEPROM waits) and host time, and how many
+// passes the reply came after the pass that could first see the last
+// byte (0: on that pass). A client that stops
+// half way must be dropped after REQUEST_TIMEOUT without stalling loop().
+//
+//   bench_slow_client
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "harness.h"
+
+#define PASS_US 1000
+
+struct Result {
+  unsigned long long worst_us, worst_ns;
+  long passes;        // from the first byte until the socket is released
+  long reply_after;   // passes from the last byte until the reply, -1 if none came
+};
+
+// 'stop_at' bytes of the request arrive, then the client goes quiet
+static Result run(size_t chunk, int gap, size_t stop_at) {
+  Result r = {0, 0, 0, -1};
+  int s = sim_connect("/vo", chunk);
+  if (s < 0) {
+    fprintf(stderr, "no socket listening\n");
+    exit(1);
+  }
+  SimSocket &k = sim_socket[s];
+  size_t total = k.rx.size();   // what the controller has not read yet
+  size_t sent = k.arrived;
+  long last_byte = sent >= total ? 0 : -1;
+  if (stop_at > total)  stop_at = total;
+  while (k.status == SnSR::ESTABLISHED && r.passes < 100000) {
+    unsigned long long us = sim_clock_us();
+    unsigned long long ns = sim_host_ns();
+    sim_loop();
+    ns = sim_host_ns() - ns;
+    us = sim_clock_us() - us;
+    if (us > r.worst_us)  r.worst_us = us;
+    if (ns > r.worst_ns)  r.worst_ns = ns;
+    if (!k.tx.empty() && r.reply_after < 0 && last_byte >= 0)  r.reply_after = r.passes - last_byte;
+    r.passes++;
+    sim_advance_us(PASS_US);
+    if (r.passes % gap == 0 && sent < stop_at) {
+      size_t n = chunk < stop_at - sent ? chunk : stop_at - sent;
+      k.arrived += n;
+      sent += n;
+      if (sent == total)  last_byte = r.passes;
+    }
+  }
+  // let the connection table release the socket
+  sim_run_us(10 * PASS_US, PASS_US);
+  return r;
+}
+
+int main() {
+  sim_power_on(SIM_EPOCH);
+  sim_set_option(OPTION_USE_NTP, 0);
+  struct { size_t chunk; int gap; } cases[] = {{1000, 1}, {8, 1}, {8, 10}, {1, 1}, {1, 10}};
+  int status = 0;
+  printf("chunk  gap  passes  reply after  worst pass: virtual us  host us\n");
+  for (unsigned i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+    Result r = run(cases[i].chunk, cases[i].gap, (size_t)-1);
+    printf("%5u %4d %7ld %12ld %24llu %8.1f\n", (unsigned)cases[i].chunk, cases[i].gap,
+           r.passes, r.reply_after, r.worst_us, r.worst_ns / 1000.0);
+    if (r.reply_after < 0)  status = 1;
+  }
+  Result r = run(8, 1, 16);
+  printf("stalled client after 16 bytes: dropped after %ld passes, worst pass %llu us virtual, %.1f us host\n",
+         r.passes, r.worst_us, r.worst_ns / 1000.0);
+  if (r.passes > REQUEST_TIMEOUT + 100 || r.reply_after >= 0)  status = 1;
+  return status;
+}
@@ -0,0 +1,562 @@
+// Host stand-ins for the Arduino core and the libraries the sketch uses.
+// Everything here is in memory and runs on the virtual clock; the state
+// tests look at or drive is declared in Arduino.h, the library headers
+// under include/, and sim.h.
+
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include "sim.h"
+#include <Wire.h>
+#include <DS1307RTC.h>
+
+// ====== Virtual clock ======
+unsigned long sim_millis, sim_micros;
+bool sim_timer_ticks = true;
+static unsigned long long clock_us;    // virtual time since power up
+static unsigned long long next_tick;   // when Timer0 next overflows
+static time_t epoch;                   // wall clock time at clock_us 0
+
+uint8_t SREG, TIMSK0, OCR0A, ADCSRA;
+
+static void set_clock(unsigned long long us) {
+  clock_us = us;
+  sim_micros = (unsigned long)us;
+  sim_millis = (unsigned long)(us / 1000);
+}
+
+// Timer0 overflows every 1024 us; its compare match A interrupt is
+// run once per overflow when enabled
+void sim_advance_us(unsigned long us) {
+  unsigned long long end = clock_us + us;
+  if (sim_timer_ticks) {
+    while (next_tick <= end) {
+      set_clock(next_tick);
+      next_tick += 1024;
+      if (TIMSK0 & _BV(OCIE0A)) {
+        ADCSRA &= ~_BV(ADSC);
+        TIMER0_COMPA_vect();
+      }
+    }
+  } else {
+    next_tick = end + 1024;
+  }
+  set_clock(end);
+}
+
+void sim_warp_us(unsigned long long us) {
+  set_clock(clock_us + us);
+  next_tick = clock_us + 1024;
+}
+
+unsigned long long sim_clock_us() {
+  return clock_us;
+}
+
+time_t now() {
+  return epoch + (time_t)(clock_us / 1000000);
+}
+
+void setTime(time_t t) {
+  epoch = t - (time_t)(clock_us / 1000000);
+}
+
+// ====== Calendar (as in the Time library) ======
+static const uint8_t month_days[] = {31,28,31,30,31,30,31,31,30,31,30,31};
+#define LEAP_YEAR(y)  (((1970+(y))>0) && !((1970+(y))%4) && (((1970+(y))%100) || !((1970+(y))%400)))
+
+void breakTime(time_t t, tmElements_t &tm) {
+  unsigned long days;
+  uint8_t year, month, len;
+  tm.Second = t % 60;  t /= 60;
+  tm.Minute = t % 60;  t /= 60;
+  tm.Hour = t % 24;    t /= 24;
+  tm.Wday = ((t + 4) % 7) + 1;   // Sunday is 1
+  year = 0;
+  days = 0;
+  while ((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= t)  year++;
+  tm.Year = year;
+  days -= LEAP_YEAR(year) ? 366 : 365;
+  t -= days;
+  for (month = 0; month < 12; month++) {
+    len = (month == 1 && LEAP_YEAR(year)) ? 29 : month_days[month];
+    if (t >= len)  t -= len;
+    else  break;
+  }
+  tm.Month = month + 1;
+  tm.Day = t + 1;
+}
+
+static tmElements_t broken(time_t t) {
+  tmElements_t tm;
+  breakTime(t, tm);
+  return tm;
+}
+int second(time_t t)  { return broken(t).Second; }
+int minute(time_t t)  { return broken(t).Minute; }
+int hour(time_t t)    { return broken(t).Hour; }
+int day(time_t t)     { return broken(t).Day; }
+int weekday(time_t t) { return broken(t).Wday; }
+int month(time_t t)   { return broken(t).Month; }
+int year(time_t t)    { return broken(t).Year + 1970; }
+
+// ====== Pins ======
+byte sim_pin[NUM_PINS];
+long sim_pin_writes;
+int sim_adc = 1023;
+volatile uint8_t sim_port_out[NUM_PINS/8+2];
+volatile uint8_t sim_port_in[NUM_PINS/8+2];
+
+static bool pin_output[NUM_PINS];
+
+void pinMode(int pin, int mode) {
+  pin_output[pin] = (mode == OUTPUT);
+}
+
+// writing an input pin switches its pull-up, which an unconnected
+// input then reads back
+void digitalWrite(int pin, int value) {
+  sim_pin_writes++;
+  if (!pin_output[pin]) {
+    sim_set_input(pin, value);
+    return;
+  }
+  sim_pin[pin] = value ? 1 : 0;
+  if (value)  sim_port_out[digitalPinToPort(pin)] |= digitalPinToBitMask(pin);
+  else        sim_port_out[digitalPinToPort(pin)] &= ~digitalPinToBitMask(pin);
+}
+
+void sim_set_input(int pin, int level) {
+  sim_pin[pin] = level ? 1 : 0;
+  if (level)  sim_port_in[digitalPinToPort(pin)] |= digitalPinToBitMask(pin);
+  else        sim_port_in[digitalPinToPort(pin)] &= ~digitalPinToBitMask(pin);
+}
+
+// ====== RAM map ======
+// The sketch reports its memory use from the linker's section symbols
+// and the stack pointer; on the host they point into an 8 KB array
+// laid out like the Mega's RAM, so the report has something to read.
+uint8_t sim_ram[8192];
+char *sim_brkval;
+uint8_t *sim_sp = sim_ram + sizeof(sim_ram) - 1;
+asm(".globl sim_data_start\n .set sim_data_start, sim_ram+0x200\n"
+    ".globl sim_data_end\n   .set sim_data_end,   sim_ram+0x300\n"
+    ".globl sim_bss_start\n  .set sim_bss_start,  sim_ram+0x300\n"
+    ".globl sim_bss_end\n    .set sim_bss_end,    sim_ram+0x1200\n"
+    ".globl sim_heap_start\n .set sim_heap_start, sim_ram+0x1200\n"
+    ".globl sim_stack\n      .set sim_stack,      sim_ram+0x1fff\n");
+
+int freeMemory() {
+  return (int)(sim_sp - (sim_ram + 0x1200));
+}
+
+// ====== Reset ======
+// The sketch reboots by calling resetFunc. While sim_boot() is running
+// setup() or loop(), that restarts setup() (RAM is not cleared as it
+// would be on the AVR); otherwise the program ends.
+int sim_reboots;
+static jmp_buf *reboot_jmp;
+
+static void sim_reset() {
+  sim_reboots++;
+  if (reboot_jmp)  longjmp(*reboot_jmp, 1);
+  fprintf(stderr, "controller reset at %lu ms\n", sim_millis);
+  exit(3);
+}
+void (*resetFunc)(void) = sim_reset;
+
+void sim_set_reboot_point(jmp_buf *jb) {
+  reboot_jmp = jb;
+}
+
+// ====== EEPROM ======
+uint8_t sim_eeprom[E2END+1];
+long sim_eeprom_reads, sim_eeprom_writes;
+
+uint8_t eeprom_read_byte(const uint8_t *addr) {
+  sim_eeprom_reads++;
+  return sim_eeprom[(uintptr_t)addr];
+}
+
+uint16_t eeprom_read_word(const uint16_t *addr) {
+  uint16_t v;
+  eeprom_read_block(&v, addr, 2);
+  return v;
+}
+
+void eeprom_read_block(void *dst, const void *addr, size_t n) {
+  sim_eeprom_reads += n;
+  memcpy(dst, &sim_eeprom[(uintptr_t)addr], n);
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t v) {
+  sim_eeprom[(uintptr_t)addr] = v;
+  sim_eeprom_writes++;
+  sim_advance_us(EEPROM_WRITE_US);
+}
+
+void eeprom_write_block(const void *src, void *addr, size_t n) {
+  const uint8_t *p = (const uint8_t *)src;
+  for (size_t i = 0; i < n; i++)
+    eeprom_write_byte((uint8_t *)addr + i, p[i]);
+}
+
+// ====== LCD, SPI, I2C and RTC ======
+char sim_lcd_ram[2][40];
+long sim_lcd_writes, sim_lcd_cmds;
+long sim_spi_bytes;
+void (*sim_spi_hook)(uint8_t b);
+SPIClass SPI;
+TwoWire Wire;
+DS1307RTC RTC;
+
+// ====== Sockets ======
+// The library reaches the W5100 one register byte at a time, each a
+// 4 byte SPI transfer; that is what a request costs the board, so it
+// is charged to the clock. A read or write of data also goes through
+// the socket's pointer registers and a command.
+#define W5100_BYTE_US     5
+#define W5100_DATA_BYTES  8
+
+static void w5100_access(size_t bytes) {
+  sim_advance_us(bytes * W5100_BYTE_US);
+}
+
+SimSocket sim_socket[MAX_SOCK_NUM];
+uint16_t EthernetClass::_server_port[MAX_SOCK_NUM];
+EthernetClass Ethernet;
+W5100Class W5100;
+
+static byte local_ip[4] = {192, 168, 1, 77};
+static byte gateway_ip[4] = {192, 168, 1, 1};
+bool sim_dhcp_answer = true;
+bool sim_ntp_answer = false;
+bool sim_ping_answer = true;
+
+int EthernetClass::begin(uint8_t *) { return 1; }
+void EthernetClass::begin(uint8_t *, IPAddress, IPAddress, IPAddress) {}
+void EthernetClass::begin(uint8_t *, IPAddress, IPAddress, IPAddress, IPAddress) {}
+IPAddress EthernetClass::localIP() { return IPAddress(local_ip); }
+IPAddress EthernetClass::gatewayIP() { return IPAddress(gateway_ip); }
+IPAddress EthernetClass::dnsServerIP() { return IPAddress(gateway_ip); }
+IPAddress EthernetClass::subnetMask() { return IPAddress(255, 255, 255, 0); }
+
+void EthernetServer::begin() {
+  for (int s = 0; s < MAX_SOCK_NUM; s++) {
+    if (sim_socket[s].status == SnSR::CLOSED) {
+      sim_socket[s].status = SnSR::LISTEN;
+      EthernetClass::_server_port[s] = port;
+      return;
+    }
+  }
+}
+
+// as the library does: put a socket back into LISTEN if none is, then
+// hand out a connected socket of this server with data waiting
+EthernetClient EthernetServer::available() {
+  bool listening = false;
+  for (int s = 0; s < MAX_SOCK_NUM; s++)
+    if (EthernetClass::_server_port[s] == port && sim_socket[s].status == SnSR::LISTEN)  listening = true;
+  if (!listening)  begin();
+  for (int s = 0; s < MAX_SOCK_NUM; s++) {
+    uint8_t st = sim_socket[s].status;
+    if (EthernetClass::_server_port[s] == port && (st == SnSR::ESTABLISHED || st == SnSR::CLOSE_WAIT)
+        && sim_socket[s].arrived)
+      return EthernetClient(s);
+  }
+  return EthernetClient();
+}
+
+uint8_t EthernetClient::status() {
+  w5100_access(1);
+  return sock < MAX_SOCK_NUM ? sim_socket[sock].status : SnSR::CLOSED;
+}
+
+uint8_t EthernetClient::connected() {
+  uint8_t st = status();
+  if (st == SnSR::LISTEN || st == SnSR::CLOSED || st == SnSR::FIN_WAIT)  return 0;
+  if (st == SnSR::CLOSE_WAIT && !available())  return 0;
+  return 1;
+}
+
+int EthernetClient::available() {
+  w5100_access(4);   // the size is read until two reads agree
+  return sock < MAX_SOCK_NUM ? (int)sim_socket[sock].arrived : 0;
+}
+
+int EthernetClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int EthernetClient::read(uint8_t *buf, size_t n) {
+  SimSocket &k = sim_socket[sock];
+  if (n > k.arrived)  n = k.arrived;
+  w5100_access(W5100_DATA_BYTES + n);
+  memcpy(buf, k.rx.data(), n);
+  k.rx.erase(0, n);
+  k.arrived -= n;
+  return n;
+}
+
+void EthernetClient::stop() {
+  sim_socket[sock].status = SnSR::CLOSED;
+  EthernetClass::_server_port[sock] = 0;
+}
+
+size_t EthernetClient::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t EthernetClient::write(const uint8_t *buf, size_t n) {
+  if (sock >= MAX_SOCK_NUM)  return 0;
+  w5100_access(W5100_DATA_BYTES + n);
+  sim_socket[sock].tx.append((const char *)buf, n);
+  sim_socket[sock].writes++;
+  return n;
+}
+
+// ICMP: an echo request on a raw socket is answered 5 ms later
+static std::string icmp_packet;
+static unsigned long icmp_at;
+
+uint8_t W5100Class::readSnSR(SOCKET s) {
+  w5100_access(1);
+  return sim_socket[s].status;
+}
+
+void W5100Class::send_data_processing(SOCKET s, const uint8_t *data, uint16_t len) {
+  if (sim_socket[s].status != SnSR::IPRAW)  return;
+  icmp_packet.assign((const char *)data, len);
+  icmp_at = sim_millis + 5;
+}
+
+uint16_t W5100Class::getRXReceivedSize(SOCKET s) {
+  w5100_access(4);
+  if (sim_socket[s].status == SnSR::IPRAW) {
+    if (!sim_ping_answer || icmp_packet.empty() || sim_millis < icmp_at)  return 0;
+    return icmp_packet.size() + 6;   // with the W5100's address/length header
+  }
+  return sim_socket[s].arrived;
+}
+
+// The unread data is kept at the front of rx, so the read pointer is
+// always 0 and an address into the socket buffer is an offset into rx.
+uint16_t W5100Class::readSnRX_RD(SOCKET) {
+  w5100_access(2);
+  return 0;
+}
+
+void W5100Class::read_data(SOCKET s, volatile uint8_t *src, volatile uint8_t *dst, uint16_t len) {
+  const SimSocket &k = sim_socket[s];
+  size_t at = (uint16_t) (uintptr_t) src;
+  w5100_access(len);
+  for (uint16_t i = 0; i < len && at + i < k.rx.size(); i++)
+    dst[i] = k.rx[at + i];
+}
+
+uint8_t socket(SOCKET s, uint8_t protocol, uint16_t, uint8_t) {
+  if (protocol == SnMR::IPRAW)  sim_socket[s].status = SnSR::IPRAW;
+  return 1;
+}
+
+void close(SOCKET s) {
+  sim_socket[s].status = SnSR::CLOSED;
+}
+
+// the peer acknowledges the FIN at once
+void disconnect(SOCKET s) {
+  sim_socket[s].status = SnSR::CLOSED;
+  sim_socket[s].closes++;
+}
+
+uint16_t recvfrom(SOCKET, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t *) {
+  memcpy(addr, gateway_ip, 4);
+  uint16_t n = icmp_packet.size() < len ? icmp_packet.size() : len;
+  memcpy(buf, icmp_packet.data(), n);
+  if (n)  buf[0] = 0;   // echo reply
+  icmp_packet.clear();
+  return n;
+}
+
+// ====== UDP ======
+#define DHCP_SERVER_PORT  67
+#define DHCP_CLIENT_PORT  68
+#define NTP_EPOCH_OFFSET  2208988800UL   // seconds from 1900 to 1970
+#define UDP_POLL_US       (4 * W5100_BYTE_US)
+
+static std::string dhcp_pending;   // reply of the emulated DHCP server
+static unsigned long dhcp_at;      // and when it arrives
+static unsigned long ntp_at;       // when the NTP answer arrives, 0 if none is due
+long sim_ntp_requests;
+long sim_ntp_utc_offset;           // seconds the virtual clock is ahead of UTC
+
+// as the library does, a UDP socket holds one of the W5100's sockets
+// until it is stopped
+uint8_t EthernetUDP::begin(uint16_t p) {
+  for (sock = 0; sock < MAX_SOCK_NUM; sock++)
+    if (sim_socket[sock].status == SnSR::CLOSED)  break;
+  if (sock == MAX_SOCK_NUM)  return 0;
+  sim_socket[sock].status = SnSR::UDP;
+  port = p;
+  return 1;
+}
+
+void EthernetUDP::stop() {
+  if (sock < MAX_SOCK_NUM)  sim_socket[sock].status = SnSR::CLOSED;
+  sock = MAX_SOCK_NUM;
+  port = 0;
+  rxlen = rxpos = 0;
+}
+
+int EthernetUDP::beginPacket(IPAddress, uint16_t p) {
+  dest = p;
+  txlen = 0;
+  return 1;
+}
+
+size_t EthernetUDP::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t EthernetUDP::write(const uint8_t *buf, size_t n) {
+  if (txlen + n > SIM_UDP_MAX)  n = SIM_UDP_MAX - txlen;
+  memcpy(tx + txlen, buf, n);
+  txlen += n;
+  return n;
+}
+
+int EthernetUDP::endPacket() {
+  if (dest == DHCP_SERVER_PORT)  dhcp_reply();
+  else {
+    sim_ntp_requests++;
+    if (sim_ntp_answer)  ntp_at = sim_millis + 20;
+  }
+  return 1;
+}
+
+// Answer a DHCP discover with an offer, and a request with an ack,
+// for 192.168.1.77 behind gateway 192.168.1.1
+void EthernetUDP::dhcp_reply() {
+  if (txlen < 240 || tx[236] != 99) {
+    fprintf(stderr, "malformed dhcp packet\n");
+    exit(1);
+  }
+  if (!sim_dhcp_answer)  return;
+  byte type = tx[242];   // first option is the message type
+  std::string r(240, '\0');
+  r[0] = 2;                                     // boot reply
+  r.replace(4, 4, (const char *)tx + 4, 4);     // xid
+  r.replace(16, 4, (const char *)local_ip, 4);  // yiaddr
+  r.replace(28, 6, (const char *)tx + 28, 6);   // chaddr
+  r[236] = 99; r[237] = (char)130; r[238] = 83; r[239] = 99;
+  const unsigned char opts[] = {
+    53, 1, (unsigned char)(type == 1 ? 2 : 5),  // offer or ack
+    54, 4, 192, 168, 1, 1,                      // server
+    1, 4, 255, 255, 255, 0,                     // subnet mask
+    3, 4, 192, 168, 1, 1,                       // router
+    6, 4, 8, 8, 8, 8,                           // dns
+    51, 4, 0, 1, 0x51, 0x80,                    // lease time
+    255
+  };
+  r.append((const char *)opts, sizeof(opts));
+  dhcp_pending = r;
+  dhcp_at = sim_millis + 50;
+}
+
+// each poll reads the W5100's receive size over SPI, which takes
+// time, so a loop waiting for an answer sees the clock move
+int EthernetUDP::parsePacket() {
+  sim_advance_us(UDP_POLL_US);
+  rxlen = rxpos = 0;
+  if (sock == MAX_SOCK_NUM)  return 0;
+  if (port == DHCP_CLIENT_PORT && !dhcp_pending.empty()) {
+    if (sim_millis < dhcp_at)  return 0;
+    rxlen = dhcp_pending.size();
+    memcpy(rx, dhcp_pending.data(), rxlen);
+    dhcp_pending.clear();
+  }
+  else if (ntp_at && sim_millis >= ntp_at) {
+    unsigned long secs = now() - sim_ntp_utc_offset + NTP_EPOCH_OFFSET;
+    ntp_at = 0;
+    rxlen = 48;
+    memset(rx, 0, rxlen);
+    rx[0] = 0x24;   // server, version 4
+    for (int i = 0; i < 4; i++)  rx[40+i] = secs >> (24 - 8*i);
+  }
+  return rxlen;
+}
+
+int EthernetUDP::read() {
+  return rxpos < rxlen ? rx[rxpos++] : -1;
+}
+
+int EthernetUDP::read(uint8_t *buf, size_t n) {
+  if (n > (size_t)(rxlen - rxpos))  n = rxlen - rxpos;
+  memcpy(buf, rx + rxpos, n);
+  rxpos += n;
+  return n;
+}
+
+IPAddress EthernetUDP::remoteIP() { return IPAddress(gateway_ip); }
+uint16_t EthernetUDP::remotePort() { return 123; }
+
+// ====== SD card ======
+const char *sim_sd_dir = "sd";
+long sim_sd_seeks, sim_sd_reads, sim_sd_writes;
+SDClass SD;
+
+bool SDClass::begin(uint8_t) {
+  return true;
+}
+
+File SDClass::open(const char *name, uint8_t mode) {
+  std::string path = std::string(sim_sd_dir) + "/" + name;
+  FILE *f = fopen(path.c_str(), "r+b");
+  if (!f && mode == FILE_WRITE)  f = fopen(path.c_str(), "w+b");
+  if (f && mode == FILE_WRITE)  fseek(f, 0, SEEK_END);   // like the library, writes append
+  return File(f);
+}
+
+bool File::seek(unsigned long pos) {
+  sim_sd_seeks++;
+  return fseek(f, pos, SEEK_SET) == 0;
+}
+
+int File::read() {
+  sim_sd_reads++;
+  return fgetc(f);
+}
+
+int File::read(void *buf, uint16_t n) {
+  sim_sd_reads++;
+  return fread(buf, 1, n, f);
+}
+
+size_t File::write(uint8_t c) {
+  sim_sd_writes++;
+  return fputc(c, f) == EOF ? 0 : 1;
+}
+
+size_t File::write(const uint8_t *buf, size_t n) {
+  sim_sd_writes++;
+  return fwrite(buf, 1, n, f);
+}
+
+void File::flush() {
+  fflush(f);
+}
+
+unsigned long File::size() {
+  long pos = ftell(f);
+  fseek(f, 0, SEEK_END);
+  long n = ftell(f);
+  fseek(f, pos, SEEK_SET);
+  return n;
+}
+
+void File::close() {
+  if (f)  fclose(f);
+  f = 0;
+}
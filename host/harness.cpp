@@ -0,0 +1,140 @@
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "harness.h"
+
+extern uint8_t __heap_start;
+
+static void boot() {
+  static int reboots;
+  jmp_buf jb;
+  if (setjmp(jb)) {
+    if (++reboots > 10) {
+      fprintf(stderr, "sim: controller keeps resetting\n");
+      exit(3);
+    }
+  }
+  sim_set_reboot_point(&jb);
+  setup();
+  sim_set_reboot_point(0);
+  reboots = 0;
+}
+
+static void empty_dir(const char *dir) {
+  mkdir(dir, 0777);
+  DIR *d = opendir(dir);
+  if (!d)  return;
+  struct dirent *e;
+  while ((e = readdir(d)) != 0) {
+    if (e->d_name[0] == '.')  continue;
+    unlink((std::string(dir) + "/" + e->d_name).c_str());
+  }
+  closedir(d);
+}
+
+void sim_power_on(time_t t, const char *sd_dir) {
+  memset(sim_eeprom, 0xff, sizeof(sim_eeprom));
+  // what the stack painter in .init3 does on the board
+  for (uint8_t *p = (uint8_t *)&__heap_start; p < sim_ram + sizeof(sim_ram); p++)
+    *p = STACK_CANARY;
+  empty_dir(sd_dir);
+  sim_sd_dir = sd_dir;
+  setTime(t);
+  boot();
+  sim_run_us(1000000);
+}
+
+void sim_loop() {
+  jmp_buf jb;
+  if (setjmp(jb)) {
+    boot();
+    return;
+  }
+  sim_set_reboot_point(&jb);
+  loop();
+  sim_set_reboot_point(0);
+}
+
+void sim_run_us(unsigned long long us, unsigned long pass_us) {
+  for (unsigned long long done = 0; done < us; done += pass_us) {
+    sim_loop();
+    sim_advance_us(pass_us);
+  }
+}
+
+time_t sim_next_wakeup() {
+  time_t t = now();
+  time_t next = (t / 60 + 1) * 60;
+  if (svc.status.program_busy && pd.next_event_time() < next)  next = pd.next_event_time();
+  if (svc.status.rain_delayed && svc.raindelay_stop_time < next)  next = svc.raindelay_stop_time;
+  if (next <= t)  next = t + 1;
+  return next;
+}
+
+void sim_run_until(time_t t, void (*each)()) {
+  bool ticks = sim_timer_ticks;
+  sim_timer_ticks = false;
+  while (now() < t) {
+    sim_loop();
+    if (each)  each();
+    time_t next = sim_next_wakeup();
+    if (next > t)  next = t;
+    // land just past the second boundary, as the board would
+    sim_warp_us((unsigned long long)(next - now()) * 1000000 - (sim_clock_us() % 1000000) + 1000);
+  }
+  sim_loop();
+  if (each)  each();
+  sim_timer_ticks = ticks;
+}
+
+void sim_set_option(byte oid, byte value) {
+  svc.options[oid].value = value;
+  svc.options_save();
+}
+
+void sim_add_program(byte d0, byte d1, uint16_t start, uint16_t end,
+                     uint16_t interval, uint16_t duration, byte stations) {
+  ProgramStruct prog;
+  memset(&prog, 0, sizeof(prog));
+  prog.enabled = 1;
+  prog.days[0] = d0;
+  prog.days[1] = d1;
+  prog.start_time = start;
+  prog.end_time = end;
+  prog.interval = interval;
+  prog.duration = duration;
+  prog.stations[0] = stations;
+  pd.add(&prog);
+}
+
+int sim_connect(const char *request, size_t arrive) {
+  for (int s = 0; s < MAX_SOCK_NUM; s++) {
+    SimSocket &k = sim_socket[s];
+    if (k.status != SnSR::LISTEN)  continue;
+    k.status = SnSR::ESTABLISHED;
+    k.rx = std::string("GET ") + request + " HTTP/1.1\r\nHost: os\r\n\r\n";
+    k.arrived = arrive ? std::min(arrive, k.rx.size()) : k.rx.size();
+    k.tx.clear();
+    return s;
+  }
+  return -1;
+}
+
+std::string sim_http(const char *request, unsigned long pass_us) {
+  int s = -1;
+  for (int i = 0; i < 100 && s < 0; i++) {
+    s = sim_connect(request);
+    if (s < 0)  sim_run_us(pass_us, pass_us);
+  }
+  if (s < 0)  return "";
+  for (int i = 0; i < 100000 && sim_socket[s].status == SnSR::ESTABLISHED; i++)
+    sim_run_us(pass_us, pass_us);
+  return sim_socket[s].tx;
+}
+
+unsigned long long sim_host_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,53 @@
+// Helpers for driving the whole sketch on the host: power it up, run
+// loop(), set it up as the web pages would, talk to its web server and
+// fast-forward the clock.
+
+#ifndef HOST_HARNESS_H
+#define HOST_HARNESS_H
+
+#include "sim.h"
+#include "OpenSprinklerGen2.h"
+#include "program.h"
+
+extern OpenSprinkler svc;
+extern ProgramData pd;
+void setup();
+void loop();
+
+#define SIM_EPOCH 1380585600UL   // 2013-10-01 00:00, a Tuesday
+
+// Power up a controller with blank EEPROM at wall clock t, run setup()
+// (and the reset that formats the EEPROM) and let the network come up.
+// SD builds keep their card in 'sd_dir', which is emptied first.
+void sim_power_on(time_t t, const char *sd_dir = "build/sdcard");
+
+// One pass of loop(); a reset by the sketch runs setup() again.
+void sim_loop();
+
+// Run loop() every pass_us of virtual time for the given time.
+void sim_run_us(unsigned long long us, unsigned long pass_us = 1000);
+
+// Time warp: run until wall clock t, skipping ahead between the
+// moments loop() has work (minute starts, station events, end of a
+// rain delay). 'each' is called after every pass.
+void sim_run_until(time_t t, void (*each)() = 0);
+time_t sim_next_wakeup();
+
+// Set an option and save it as the web page would.
+void sim_set_option(byte oid, byte value);
+
+// Add a program; stations are given for the first board only.
+void sim_add_program(byte d0, byte d1, uint16_t start, uint16_t end,
+                     uint16_t interval, uint16_t duration, byte stations);
+
+// Open a connection to the web server and deliver 'request' (the path,
+// e.g. "/jo"); 'arrive' bytes of it reach the controller each pass (0
+// for all at once). Returns the socket, or -1 if none is listening.
+int sim_connect(const char *request, size_t arrive = 0);
+// Whole exchange: connect, run until the controller closes, return the reply.
+std::string sim_http(const char *request, unsigned long pass_us = 1000);
+
+// Host wall clock in nanoseconds, for timing.
+unsigned long long sim_host_ns();
+
+#endif
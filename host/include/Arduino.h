@@ -0,0 +1,119 @@
+// Host stand-in for the Arduino core (see host/Makefile)
+//
+// Time only moves when the simulation moves it: delay() and
+// delayMicroseconds() advance the virtual clock, and every virtual
+// millisecond runs the Timer0 compare interrupt like the real timer.
+// Pins, ports and the few AVR registers the sketch touches are plain
+// memory the test programs can read and set.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+#define A0      54
+#define NUM_PINS 70
+
+// binary constants used by the sketch
+#define B00000  0
+#define B00001  1
+#define B00101  5
+#define B01000  8
+#define B10100  20
+#define B10101  21
+
+// ====== Virtual clock ======
+extern unsigned long sim_millis, sim_micros;
+void sim_advance_us(unsigned long us);  // move the clock, running the timer interrupts that fall due
+
+inline unsigned long millis() { return sim_millis; }
+inline unsigned long micros() { return sim_micros; }
+inline void delay(unsigned long ms) { sim_advance_us(ms*1000); }
+inline void delayMicroseconds(unsigned int us) { sim_advance_us(us); }
+
+// ====== Pins ======
+extern byte sim_pin[NUM_PINS];      // level of each pin, as last written or as driven by a test
+extern long sim_pin_writes;         // digitalWrite() calls
+extern int sim_adc;                 // reading returned for any analog input
+void digitalWrite(int pin, int value);
+inline int digitalRead(int pin) { return sim_pin[pin]; }
+void pinMode(int pin, int mode);
+inline int analogRead(int) { return sim_adc; }
+inline void analogWrite(int, int) {}
+
+// Ports: eight pins per port, port 0 unused like NOT_A_PIN
+#define NOT_A_PIN  0
+#define digitalPinToPort(p)     ((p)/8+1)
+#define digitalPinToBitMask(p)  (1<<((p)%8))
+extern volatile uint8_t sim_port_out[];
+extern volatile uint8_t sim_port_in[];
+#define portOutputRegister(P)   (&sim_port_out[P])
+#define portInputRegister(P)    (&sim_port_in[P])
+
+// ====== AVR registers and interrupts ======
+#define _BV(b)  (1<<(b))
+extern uint8_t SREG, TIMSK0, OCR0A, ADCSRA;
+#define OCIE0A  1
+#define ADSC    6
+#define ADC     ((unsigned int)sim_adc) // conversions finish before the next timer tick
+inline void cli() {}
+inline void sei() {}
+#define ISR(vector)  void vector()
+void TIMER0_COMPA_vect();
+
+// ====== RAM ======
+// RAM layout symbols, mapped onto an 8 KB array (see hal.cpp)
+#define __data_start  sim_data_start
+#define __data_end    sim_data_end
+#define __bss_start   sim_bss_start
+#define __bss_end     sim_bss_end
+#define __heap_start  sim_heap_start
+#define __stack       sim_stack
+#define __brkval      sim_brkval
+extern uint8_t *sim_sp;
+#define SP  ((uintptr_t)sim_sp)
+
+// ====== Number formatting ======
+inline char *itoa(int v, char *buf, int) { sprintf(buf, "%d", v); return buf; }
+inline char *ltoa(long v, char *buf, int) { sprintf(buf, "%ld", v); return buf; }
+inline char *ultoa(unsigned long v, char *buf, int) { sprintf(buf, "%lu", v); return buf; }
+
+// The AVR promotes byte and int varargs to 16 bits, the host to int:
+// read small types the way they were passed
+#undef va_arg
+#define va_arg(ap, t)  ((t)__builtin_va_arg(ap, __typeof__(+(t)0)))
+
+// ====== Print ======
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t n) {
+    size_t r = 0;
+    while (n--)  r += write(*buf++);
+    return r;
+  }
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { char b[16]; sprintf(b, "%d", v); return print(b); }
+  size_t print(unsigned int v) { char b[16]; sprintf(b, "%u", v); return print(b); }
+  size_t print(long v) { char b[16]; sprintf(b, "%ld", v); return print(b); }
+  size_t print(unsigned long v) { char b[16]; sprintf(b, "%lu", v); return print(b); }
+};
+
+#endif
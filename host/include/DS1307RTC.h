@@ -0,0 +1,11 @@
+// Host stand-in: an RTC that is present and follows the virtual clock
+#ifndef HOST_DS1307RTC_H
+#define HOST_DS1307RTC_H
+#include <Time.h>
+struct DS1307RTC {
+  static time_t get() { return now(); }
+  static bool set(time_t) { return true; }
+  static bool chipPresent() { return true; }
+};
+extern DS1307RTC RTC;
+#endif
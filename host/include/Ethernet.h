@@ -0,0 +1,70 @@
+// Host stand-in for the Ethernet library. Sockets are driven by the
+// test program through sim_socket[] (see host/sim.h).
+#ifndef HOST_ETHERNET_H
+#define HOST_ETHERNET_H
+#include <Arduino.h>
+
+typedef uint8_t SOCKET;
+#define MAX_SOCK_NUM 4
+
+class IPAddress {
+public:
+  IPAddress() { memset(a, 0, 4); }
+  IPAddress(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) {
+    a[0] = b0; a[1] = b1; a[2] = b2; a[3] = b3;
+  }
+  IPAddress(const uint8_t *p) {
+    if (p)  memcpy(a, p, 4);
+    else    memset(a, 0, 4);
+  }
+  uint8_t operator[](int i) const { return a[i]; }
+  uint8_t &operator[](int i) { return a[i]; }
+  bool operator==(const IPAddress &o) const { return memcmp(a, o.a, 4) == 0; }
+  bool operator!=(const IPAddress &o) const { return !(*this == o); }
+private:
+  uint8_t a[4];
+};
+
+class EthernetClient : public Print {
+public:
+  EthernetClient() : sock(MAX_SOCK_NUM) {}
+  EthernetClient(uint8_t s) : sock(s) {}
+  uint8_t status();
+  uint8_t connected();
+  int available();
+  int read();
+  int read(uint8_t *buf, size_t n);
+  int peek() { return -1; }
+  void flush() {}
+  void stop();
+  uint8_t getSocketNumber() { return sock; }
+  operator bool() { return sock != MAX_SOCK_NUM; }
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t *buf, size_t n);
+  using Print::write;
+private:
+  uint8_t sock;
+};
+
+class EthernetServer {
+public:
+  EthernetServer(uint16_t port) : port(port) {}
+  void begin();   // put the first closed socket into LISTEN
+  EthernetClient available();
+private:
+  uint16_t port;
+};
+
+class EthernetClass {
+public:
+  static uint16_t _server_port[MAX_SOCK_NUM];
+  int begin(uint8_t *mac);
+  void begin(uint8_t *mac, IPAddress ip, IPAddress dns, IPAddress gateway);
+  void begin(uint8_t *mac, IPAddress ip, IPAddress dns, IPAddress gateway, IPAddress subnet);
+  IPAddress localIP();
+  IPAddress gatewayIP();
+  IPAddress dnsServerIP();
+  IPAddress subnetMask();
+};
+extern EthernetClass Ethernet;
+#endif
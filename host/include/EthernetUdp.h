@@ -0,0 +1,33 @@
+// Host stand-in for EthernetUDP. Two peers are emulated: a DHCP server
+// answering on port 68 and an NTP server answering everything else
+// (see host/hal.cpp; both can be told to stay silent).
+#ifndef HOST_ETHERNETUDP_H
+#define HOST_ETHERNETUDP_H
+#include <Ethernet.h>
+
+#define SIM_UDP_MAX  600
+
+class EthernetUDP : public Print {
+public:
+  EthernetUDP() : sock(MAX_SOCK_NUM), port(0), dest(0), txlen(0), rxlen(0), rxpos(0) {}
+  uint8_t begin(uint16_t p);
+  void stop();
+  int beginPacket(IPAddress ip, uint16_t port);
+  int endPacket();
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t *buf, size_t n);
+  using Print::write;
+  int parsePacket();
+  int available() { return rxlen - rxpos; }
+  int read();
+  int read(uint8_t *buf, size_t n);
+  IPAddress remoteIP();
+  uint16_t remotePort();
+private:
+  uint8_t sock;   // the sim_socket[] it holds, MAX_SOCK_NUM if none
+  uint16_t port, dest;
+  uint8_t tx[SIM_UDP_MAX], rx[SIM_UDP_MAX];
+  int txlen, rxlen, rxpos;
+  void dhcp_reply();
+};
+#endif
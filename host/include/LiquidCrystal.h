@@ -0,0 +1,38 @@
+// Host stand-in for a 16x2 HD44780: keeps the display RAM (40 columns
+// per row, as on the controller) and counts writes and commands
+#ifndef HOST_LIQUIDCRYSTAL_H
+#define HOST_LIQUIDCRYSTAL_H
+#include <Arduino.h>
+
+extern char sim_lcd_ram[2][40];
+extern long sim_lcd_writes, sim_lcd_cmds;
+
+class LiquidCrystal : public Print {
+public:
+  LiquidCrystal(int, int, int, int, int, int) : col(0), row(0) {}
+  void begin(int, int) { clear(); }
+  void clear() {
+    sim_lcd_cmds++;
+    memset(sim_lcd_ram, ' ', sizeof(sim_lcd_ram));
+    col = row = 0;
+  }
+  void setCursor(int c, int r) {
+    sim_lcd_cmds++;
+    col = c;
+    row = r;
+  }
+  void blink() { sim_lcd_cmds++; }
+  void noBlink() { sim_lcd_cmds++; }
+  // writes go to character generator RAM until the next setCursor
+  void createChar(int, uint8_t *) { sim_lcd_cmds++; row = -1; }
+  virtual size_t write(uint8_t c) {
+    sim_lcd_writes++;
+    if (row >= 0 && row < 2 && col < 40)  sim_lcd_ram[row][col] = c;
+    col++;
+    return 1;
+  }
+  using Print::write;
+private:
+  int col, row;
+};
+#endif
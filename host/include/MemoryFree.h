@@ -0,0 +1,5 @@
+// Host stand-in
+#ifndef HOST_MEMORYFREE_H
+#define HOST_MEMORYFREE_H
+int freeMemory();
+#endif
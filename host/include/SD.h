@@ -0,0 +1,36 @@
+// Host stand-in for the SD library: files live in a directory on the
+// host (sim_sd_dir), and seeks, reads and writes are counted
+#ifndef HOST_SD_H
+#define HOST_SD_H
+#include <stdio.h>
+#include <stdint.h>
+
+#define FILE_READ   1
+#define FILE_WRITE  2
+
+extern const char *sim_sd_dir;
+extern long sim_sd_seeks, sim_sd_reads, sim_sd_writes;
+
+class File {
+public:
+  File(FILE *f = 0) : f(f) {}
+  operator bool() const { return f != 0; }
+  bool seek(unsigned long pos);
+  int read();
+  int read(void *buf, uint16_t n);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buf, size_t n);
+  void flush();
+  unsigned long size();
+  void close();
+private:
+  FILE *f;
+};
+
+class SDClass {
+public:
+  bool begin(uint8_t cs_pin);
+  File open(const char *name, uint8_t mode = FILE_READ);
+};
+extern SDClass SD;
+#endif
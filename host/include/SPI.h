@@ -0,0 +1,22 @@
+// Host stand-in: counts the bytes sent and hands them to a test hook
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+#include <Arduino.h>
+#define SPI_MODE0       0
+#define MSBFIRST        1
+#define SPI_CLOCK_DIV2  4
+extern long sim_spi_bytes;
+extern void (*sim_spi_hook)(uint8_t b);
+struct SPIClass {
+  void begin() {}
+  void setBitOrder(int) {}
+  void setDataMode(int) {}
+  void setClockDivider(int) {}
+  uint8_t transfer(uint8_t b) {
+    sim_spi_bytes++;
+    if (sim_spi_hook)  sim_spi_hook(b);
+    return b;
+  }
+};
+extern SPIClass SPI;
+#endif
@@ -0,0 +1,39 @@
+// Host stand-in for the Time library, on the virtual clock
+#ifndef HOST_TIME_H
+#define HOST_TIME_H
+#include <stdint.h>
+#include <stdlib.h>   // pulls in the system time_t before it is renamed below
+
+// the library's time_t is an unsigned 32-bit count of seconds; the
+// system headers have their own, so the sketch's is renamed
+typedef unsigned long sim_time_t;
+#define time_t sim_time_t
+
+#define SECS_PER_MIN   60UL
+#define SECS_PER_HOUR  3600UL
+#define SECS_PER_DAY   86400UL
+
+struct tmElements_t {
+  uint8_t Second, Minute, Hour;
+  uint8_t Wday;   // day of week, Sunday is 1
+  uint8_t Day, Month;
+  uint8_t Year;   // offset from 1970
+};
+typedef time_t (*getExternalTime)();
+
+// the wall clock runs off the virtual clock, like the library's does off millis()
+time_t now();
+void setTime(time_t t);
+inline void setSyncInterval(time_t) {}
+inline void setSyncProvider(getExternalTime) {}
+
+void breakTime(time_t t, tmElements_t &tm);
+int second(time_t t);
+int minute(time_t t);
+int hour(time_t t);
+int day(time_t t);
+int weekday(time_t t);
+int month(time_t t);
+int year(time_t t);
+inline int weekday() { return weekday(now()); }
+#endif
@@ -0,0 +1,9 @@
+// Host stand-in: alarms never fire
+#ifndef HOST_TIMEALARMS_H
+#define HOST_TIMEALARMS_H
+struct AlarmClass {
+  template<class F> int alarmRepeat(int, int, int, F) { return 0; }
+  void delay(unsigned long) {}
+};
+static AlarmClass Alarm;
+#endif
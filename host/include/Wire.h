@@ -0,0 +1,6 @@
+// Host stand-in: no I2C bus
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+struct TwoWire { void begin() {} };
+extern TwoWire Wire;
+#endif
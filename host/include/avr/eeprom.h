@@ -0,0 +1,21 @@
+// Host stand-in: a 4 KB EEPROM in memory. Each byte written costs
+// the 3.3 ms the AVR takes, so write stalls show up in loop timings.
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+#include <stdint.h>
+#include <stddef.h>
+
+#define E2END  0xFFF
+#define EEPROM_WRITE_US  3300
+
+extern uint8_t sim_eeprom[E2END+1];
+extern long sim_eeprom_reads;    // bytes read
+extern long sim_eeprom_writes;   // bytes written
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+uint16_t eeprom_read_word(const uint16_t *addr);
+void eeprom_read_block(void *dst, const void *addr, size_t n);
+void eeprom_write_byte(uint8_t *addr, uint8_t v);
+void eeprom_write_block(const void *src, void *addr, size_t n);
+inline void eeprom_busy_wait() {}
+#endif
@@ -0,0 +1 @@
+// Host stand-in: see ISR() and cli()/sei() in Arduino.h
@@ -0,0 +1,26 @@
+// Host stand-in: program memory is ordinary memory
+#ifndef HOST_PGMSPACE_H
+#define HOST_PGMSPACE_H
+#include <string.h>
+#include <strings.h>
+
+#define PROGMEM
+#define PSTR(s)  (s)
+typedef const char *PGM_P;
+typedef char prog_char;
+typedef unsigned char prog_uchar;
+
+#define pgm_read_byte(p)  (*(const unsigned char *)(p))
+#define pgm_read_word(p)  (*(const unsigned short *)(p))
+#define memcpy_P       memcpy
+#define memcmp_P       memcmp
+#define strcpy_P       strcpy
+#define strncpy_P      strncpy
+#define strcmp_P       strcmp
+#define strncmp_P      strncmp
+#define strcasecmp_P   strcasecmp
+#define strncasecmp_P  strncasecmp
+#define strlen_P       strlen
+#define strstr_P       strstr
+#define strcasestr_P   strcasestr
+#endif
@@ -0,0 +1,9 @@
+// Host stand-in for the W5100 socket calls
+#ifndef HOST_SOCKET_H
+#define HOST_SOCKET_H
+#include <utility/w5100.h>
+uint8_t socket(SOCKET s, uint8_t protocol, uint16_t port, uint8_t flag);
+void close(SOCKET s);
+void disconnect(SOCKET s);
+uint16_t recvfrom(SOCKET s, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t *port);
+#endif
@@ -0,0 +1,70 @@
+// Host stand-in for the W5100 register interface, backed by sim_socket[]
+#ifndef HOST_W5100_H
+#define HOST_W5100_H
+#include <Arduino.h>
+#include <Ethernet.h>
+
+class SnSR {
+public:
+  static const uint8_t CLOSED      = 0x00;
+  static const uint8_t INIT        = 0x13;
+  static const uint8_t LISTEN      = 0x14;
+  static const uint8_t SYNSENT     = 0x15;
+  static const uint8_t SYNRECV     = 0x16;
+  static const uint8_t ESTABLISHED = 0x17;
+  static const uint8_t FIN_WAIT    = 0x18;
+  static const uint8_t CLOSING     = 0x1A;
+  static const uint8_t TIME_WAIT   = 0x1B;
+  static const uint8_t CLOSE_WAIT  = 0x1C;
+  static const uint8_t LAST_ACK    = 0x1D;
+  static const uint8_t UDP         = 0x22;
+  static const uint8_t IPRAW       = 0x32;
+};
+
+class SnMR {
+public:
+  static const uint8_t CLOSE = 0;
+  static const uint8_t TCP   = 1;
+  static const uint8_t UDP   = 2;
+  static const uint8_t IPRAW = 3;
+};
+
+class SnIR {
+public:
+  static const uint8_t SEND_OK = 0x10;
+  static const uint8_t TIMEOUT = 0x08;
+  static const uint8_t RECV    = 0x04;
+  static const uint8_t DISCON  = 0x02;
+  static const uint8_t CON     = 0x01;
+};
+
+class IPPROTO {
+public:
+  static const uint8_t IP   = 0;
+  static const uint8_t ICMP = 1;
+};
+
+enum SockCMD {
+  Sock_OPEN = 0x01, Sock_LISTEN = 0x02, Sock_CONNECT = 0x04, Sock_DISCON = 0x08,
+  Sock_CLOSE = 0x10, Sock_SEND = 0x20, Sock_RECV = 0x40
+};
+
+class W5100Class {
+public:
+  void init() {}
+  uint8_t readSnSR(SOCKET s);
+  void writeSnIR(SOCKET, uint8_t) {}
+  void writeSnPROTO(SOCKET, uint8_t) {}
+  void writeSnDIPR(SOCKET, uint8_t *) {}
+  void send_data_processing(SOCKET s, const uint8_t *data, uint16_t len);
+  void execCmdSn(SOCKET, SockCMD) {}
+  uint16_t getRXReceivedSize(SOCKET s);
+  uint16_t readSnRX_RD(SOCKET s);
+  void read_data(SOCKET s, volatile uint8_t *src, volatile uint8_t *dst, uint16_t len);
+  void setMACAddress(uint8_t *) {}
+  void setIPAddress(uint8_t *) {}
+  void setGatewayIp(uint8_t *) {}
+  void setSubnetMask(uint8_t *) {}
+};
+extern W5100Class W5100;
+#endif
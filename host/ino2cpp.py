@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Turn the sketch's .ino files into one C++ file, as the Arduino IDE does:
+the main .ino first, then the others in name order, with prototypes for
+all free functions placed after the main file's includes, under the same
+#if conditions as the functions themselves."""
+
+import os
+import re
+import sys
+
+sketch = sys.argv[1]
+main = os.path.basename(os.path.normpath(sketch)) + '.ino'
+files = [main] + sorted(f for f in os.listdir(sketch)
+                        if f.endswith('.ino') and f != main)
+
+body = ''
+for f in files:
+    path = os.path.join(sketch, f)
+    body += '#line 1 "%s"\n' % os.path.abspath(path)
+    body += open(path).read() + '\n'
+
+# function definitions at the start of a line: "type name(args) {"
+definition = re.compile(
+    r'^((?:static\s+|unsigned\s+)*[A-Za-z_][\w<>]*\s*\*?\s+\*?[A-Za-z_]\w*)'
+    r'\s*\(([^;{)]*)\)\s*\{', re.M)
+# the preprocessor conditions each line is under, so a prototype is only
+# declared where its function is defined: one level per open #if, holding
+# the conditions of the branches passed over and the current one
+conditional = re.compile(r'^\s*#\s*(if|ifdef|ifndef|elif|else|endif)\b(.*)$', re.M)
+levels = []
+conditions = []  # (offset, condition from there on)
+for m in conditional.finditer(body):
+    what, rest = m.group(1), m.group(2).split('//')[0].split('/*')[0].strip()
+    if what == 'if':
+        levels.append(['(%s)' % rest])
+    elif what == 'ifdef':
+        levels.append(['defined(%s)' % rest])
+    elif what == 'ifndef':
+        levels.append(['!defined(%s)' % rest])
+    elif what == 'elif':
+        levels[-1][-1] = '!' + levels[-1][-1]
+        levels[-1].append('(%s)' % rest)
+    elif what == 'else':
+        levels[-1][-1] = '!' + levels[-1][-1]
+    else:
+        levels.pop()
+    conditions.append((m.end(), ' && '.join(c for level in levels for c in level)))
+
+def condition(at):
+    cond = ''
+    for offset, c in conditions:
+        if offset > at:
+            break
+        cond = c
+    return cond
+
+protos = []
+for m in definition.finditer(body):
+    head, args = m.group(1), m.group(2)
+    if head.split()[0] in ('else', 'return', 'if', 'while', 'for', 'switch'):
+        continue
+    proto = '%s(%s);' % (head, args)
+    cond = condition(m.start())
+    protos.append('#if %s\n%s\n#endif' % (cond, proto) if cond else proto)
+
+# the IDE puts the prototypes after the last include of the main file
+includes = [m.end() for m in re.finditer(r'^#include.*$', body[:body.find('#line 1', 1)], re.M)]
+cut = includes[-1] + 1 if includes else 0
+sys.stdout.write('#include <Arduino.h>\n' + body[:cut] + '\n'.join(protos) + '\n'
+                 + '#line %d "%s"\n' % (body[:cut].count('\n'), os.path.abspath(os.path.join(sketch, main)))
+                 + body[cut:])
@@ -0,0 +1,104 @@
+// Load generator for the web server: 'clients' clients each send GET
+// requests back to back, over a new connection each time, until
+// 'total' replies have come back. A request costs the virtual time of
+// its W5100 traffic (see hal.cpp); with -u every loop() pass is charged
+// 'pass_us' more, standing in for other work the board does in a pass.
+// Prints requests per second and the median, 99th percentile and worst
+// latency, from connecting to the reply being complete, in virtual time.
+//
+//   loadgen [-c clients] [-n total] [-k chunk] [-u pass_us] [-s] [path]
+//
+// With -k a client sends its request 'chunk' bytes per pass. With -s
+// one more client sends the first 16 bytes of a request and then
+// nothing, over and over; its requests are not counted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "harness.h"
+
+int main(int argc, char **argv) {
+  int clients = 4, c;
+  long total = 2000;
+  size_t chunk = 0;
+  unsigned long pass_us = 0;
+  bool stall = false;
+  while ((c = getopt(argc, argv, "c:n:k:u:s")) != -1) {
+    switch (c) {
+    case 'c': clients = atoi(optarg); break;
+    case 'n': total = atol(optarg); break;
+    case 'k': chunk = atoi(optarg); break;
+    case 'u': pass_us = atol(optarg); break;
+    case 's': stall = true; break;
+    default:
+      fprintf(stderr, "usage: loadgen [-c clients] [-n total] [-k chunk] [-u pass_us] [-s] [path]\n");
+      return 2;
+    }
+  }
+  const char *path = optind < argc ? argv[optind] : "/sn0";
+
+  sim_power_on(SIM_EPOCH);
+  sim_set_option(OPTION_USE_NTP, 0);
+  sim_set_option(OPTION_IGNORE_PASSWORD, 1);
+
+  std::vector<unsigned long long> waiting(clients, sim_clock_us());  // clients not connected, since when
+  unsigned long long started_at[MAX_SOCK_NUM];
+  bool busy[MAX_SOCK_NUM] = {false};
+  int stalled = -1;   // socket of the stalled client, -1 while it waits
+  std::vector<unsigned long long> latency;
+  long started = 0, bad = 0;
+  unsigned long long t0 = sim_clock_us();
+
+  while ((long)latency.size() < total) {
+    if (stall && stalled < 0 && (stalled = sim_connect(path, 16)) >= 0)
+      busy[stalled] = true;    // connect waiting clients to listening sockets
+    for (int s = 0; s < MAX_SOCK_NUM && !waiting.empty() && started < total; s++) {
+      if (busy[s] || sim_socket[s].status != SnSR::LISTEN)  continue;
+      if (sim_connect(path, chunk) != s)  continue;   // the first listening socket is s
+      started_at[s] = waiting.front();
+      waiting.erase(waiting.begin());
+      busy[s] = true;
+      started++;
+    }
+    // slow clients send the next piece
+    for (int s = 0; s < MAX_SOCK_NUM; s++) {
+      SimSocket &k = sim_socket[s];
+      if (busy[s] && s != stalled && k.status == SnSR::ESTABLISHED && k.arrived < k.rx.size())
+        k.arrived = std::min(k.rx.size(), k.arrived + (chunk ? chunk : k.rx.size()));
+    }
+
+    sim_loop();
+    sim_advance_us(pass_us);
+
+    // a closed socket ends its request, and its client starts the next one
+    for (int s = 0; s < MAX_SOCK_NUM; s++) {
+      if (!busy[s] || sim_socket[s].status == SnSR::ESTABLISHED)  continue;
+      busy[s] = false;
+      if (s == stalled) {
+        stalled = -1;
+        continue;
+      }
+      if (sim_socket[s].tx.compare(0, 9, "HTTP/1.0 ") != 0)  bad++;
+      latency.push_back(sim_clock_us() - started_at[s]);
+      waiting.push_back(sim_clock_us());
+    }
+    if (sim_clock_us() - t0 > 600000000ULL) {
+      fprintf(stderr, "loadgen: no progress after 600 s\n");
+      return 1;
+    }
+  }
+
+  double secs = (sim_clock_us() - t0) / 1e6;
+  std::sort(latency.begin(), latency.end());
+  printf("%d clients, %s%s%s: %ld requests in %.2f s -> %.1f req/s, p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+         clients, stall ? "1 stalled, " : "", chunk ? "trickled, " : "", path, (long)latency.size(), secs, latency.size() / secs,
+         latency[latency.size() / 2] / 1000.0, latency[latency.size() * 99 / 100] / 1000.0,
+         latency.back() / 1000.0);
+  if (bad) {
+    printf("%ld replies without a status line\n", bad);
+    return 1;
+  }
+  return 0;
+}
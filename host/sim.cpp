@@ -0,0 +1,105 @@
+// Time-warp simulator: runs the sketch against a virtual clock that
+// jumps from one scheduled moment to the next, so a year of watering
+// replays in seconds. Prints every valve change and a summary.
+//
+//   sim [-q] [-d days] [-o oid=value]... [programs-file]
+//
+// A programs file has one program per line, with the fields of
+// ProgramStruct in order (numbers in C notation, # starts a comment):
+//   days0 days1 start_time end_time interval duration stations
+// For "every N days" programs give days0 as 0x80|remainder and days1 as
+// N, as the web page does; the simulator converts the remainder to the
+// absolute form the sketch stores.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "harness.h"
+
+static bool quiet;
+static byte last_bits[MAX_EXT_BOARDS+1];
+static long changes, passes;
+
+static void print_changes() {
+  passes++;
+  if (!memcmp(last_bits, svc.station_bits, sizeof(last_bits)))  return;
+  time_t t = now();
+  if (!quiet)
+    printf("%04d-%02d-%02d %02d:%02d:%02d", year(t), month(t), day(t), hour(t), minute(t), second(t));
+  for (byte sid = 0; sid < (svc.nboards << 3); sid++) {
+    byte was = (last_bits[sid>>3] >> (sid&7)) & 1;
+    byte is = (svc.station_bits[sid>>3] >> (sid&7)) & 1;
+    if (was == is)  continue;
+    changes++;
+    if (!quiet)  printf(" %c%d", is ? '+' : '-', sid+1);
+  }
+  if (!quiet)  printf("\n");
+  memcpy(last_bits, svc.station_bits, sizeof(last_bits));
+}
+
+static void load_programs(const char *name) {
+  FILE *f = fopen(name, "r");
+  if (!f) {
+    perror(name);
+    exit(2);
+  }
+  char line[200];
+  while (fgets(line, sizeof(line), f)) {
+    char *p = line;
+    long v[7];
+    int n;
+    for (n = 0; n < 7; n++) {
+      char *e;
+      v[n] = strtol(p, &e, 0);
+      if (e == p)  break;
+      p = e;
+    }
+    if (n == 0)  continue;
+    if (n < 7) {
+      fprintf(stderr, "%s: bad line: %s", name, line);
+      exit(2);
+    }
+    byte days[2] = {(byte)v[0], (byte)v[1]};
+    if ((days[0] & 0x80) && days[1] > 1)  pd.drem_to_absolute(days);
+    sim_add_program(days[0], days[1], v[2], v[3], v[4], v[5], v[6]);
+  }
+  fclose(f);
+}
+
+int main(int argc, char **argv) {
+  int days = 365, c;
+  static struct { byte oid, value; } opts[NUM_OPTIONS];
+  int nopts = 0;
+  while ((c = getopt(argc, argv, "qd:o:")) != -1) {
+    switch (c) {
+    case 'q': quiet = true; break;
+    case 'd': days = atoi(optarg); break;
+    case 'o': {
+      int oid, value;
+      if (sscanf(optarg, "%d=%d", &oid, &value) != 2 || oid >= NUM_OPTIONS || nopts == NUM_OPTIONS) {
+        fprintf(stderr, "sim: bad option %s\n", optarg);
+        return 2;
+      }
+      opts[nopts].oid = oid;
+      opts[nopts++].value = value;
+      break;
+    }
+    default:
+      fprintf(stderr, "usage: sim [-q] [-d days] [-o oid=value]... [programs-file]\n");
+      return 2;
+    }
+  }
+
+  sim_power_on(SIM_EPOCH);
+  for (int i = 0; i < nopts; i++)  sim_set_option(opts[i].oid, opts[i].value);
+  if (optind < argc)  load_programs(argv[optind]);
+
+  unsigned long long t0 = sim_host_ns();
+  long eeprom_reads = sim_eeprom_reads;
+  sim_run_until(SIM_EPOCH + (time_t)days * 86400, print_changes);
+  double secs = (sim_host_ns() - t0) / 1e9;
+
+  printf("%d days, %d programs: %ld valve changes, %ld loop passes, %ld EEPROM reads, %.2f s\n",
+         days, pd.nprograms, changes, passes, sim_eeprom_reads - eeprom_reads, secs);
+  return 0;
+}
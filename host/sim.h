@@ -0,0 +1,54 @@
+// State of the host stand-ins that test programs drive and inspect
+// (see hal.cpp). Include this before any sketch header: the system
+// headers it pulls in must come before Time.h renames time_t.
+
+#ifndef HOST_SIM_H
+#define HOST_SIM_H
+
+#include <string>
+#include <setjmp.h>
+#include <Arduino.h>
+#include <Time.h>
+#include <avr/eeprom.h>
+#include <LiquidCrystal.h>
+#include <SPI.h>
+#include <SD.h>
+#include <Ethernet.h>
+#include <EthernetUdp.h>
+#include <utility/w5100.h>
+
+// -- Clock --
+extern bool sim_timer_ticks;             // run the Timer0 interrupt as time passes (default on)
+void sim_warp_us(unsigned long long us); // jump the clock ahead without running interrupts
+unsigned long long sim_clock_us();       // virtual time since power up
+
+// -- Pins --
+void sim_set_input(int pin, int level);  // drive an input pin (both digitalRead and its port)
+
+// -- Reset --
+extern int sim_reboots;                  // times the sketch has reset the controller
+void sim_set_reboot_point(jmp_buf *jb);  // where a reset goes, 0 to end the program
+
+// -- RAM --
+extern uint8_t sim_ram[8192];
+
+// -- Sockets --
+// A client connects by moving a LISTEN socket to ESTABLISHED and putting
+// its request in rx; 'arrived' is how much of rx the W5100 has received
+// so far, so a slow client can be modelled by raising it bit by bit.
+struct SimSocket {
+  uint8_t status;
+  std::string rx;
+  size_t arrived;
+  std::string tx;   // everything written back
+  long writes;      // write calls
+  long closes;      // disconnects
+};
+extern SimSocket sim_socket[MAX_SOCK_NUM];
+extern bool sim_dhcp_answer;     // the DHCP server answers (default on)
+extern bool sim_ntp_answer;      // the NTP server answers (default off)
+extern bool sim_ping_answer;     // the gateway answers pings (default on)
+extern long sim_ntp_requests;
+extern long sim_ntp_utc_offset;  // seconds the virtual clock is ahead of UTC
+
+#endif
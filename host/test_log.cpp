@@ -0,0 +1,92 @@
+// Tests of the run log: records keep their real end times when the
+// clock is set back, time searches (log_find) cover the records before
+// and since then, across ring wrap-around and a reboot, and /jl lists
+// the matches of both in time order.
+
+#include <stdio.h>
+#include "harness.h"
+
+static int failures;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    failures++; \
+  } } while (0)
+
+static void append(byte sid, unsigned long endtime) {
+  LogStruct rec;
+  rec.station = sid;
+  rec.program = 1;
+  rec.duration = 60;
+  rec.endtime = endtime;
+  pd.log_append(&rec);
+}
+
+static unsigned long endtime(unsigned int k) {
+  LogStruct rec;
+  pd.log_read(k, &rec);
+  return rec.endtime;
+}
+
+static void test_set_back() {
+  for (unsigned i = 0; i < 10; i++)  append(i % 8, SIM_EPOCH + 1000 + i * 100);
+  CHECK(pd.log_find(SIM_EPOCH + 1450, 1) == 5);
+  // the clock is set back by an hour
+  for (unsigned i = 0; i < 5; i++)  append(i % 8, SIM_EPOCH + i * 100);
+  CHECK(pd.nlogs == 15);
+  CHECK(endtime(10) == SIM_EPOCH);          // stored as it was, not clamped
+  CHECK(endtime(14) == SIM_EPOCH + 400);
+  CHECK(pd.log_find(0, 1) == 10);
+  CHECK(pd.log_find(SIM_EPOCH + 150, 1) == 12);
+  CHECK(pd.log_find(SIM_EPOCH + 1450, 1) == 15);
+  // the records from before the set-back are searched on their own
+  CHECK(pd.log_run_end(0) == 10);
+  CHECK(pd.log_find(0, 0) == 0);
+  CHECK(pd.log_find(SIM_EPOCH + 1450, 0) == 5);
+  CHECK(pd.log_find(SIM_EPOCH + 2000, 0) == 10);
+  // and /jl merges the two
+  char url[128];
+  sprintf(url, "/jl?s=%lu&e=%lu", SIM_EPOCH + 300, SIM_EPOCH + 1200);
+  std::string r = sim_http(url);
+  sprintf(url, "\"log\":[[3,1,60,%lu],[4,1,60,%lu],[0,1,60,%lu],[1,1,60,%lu],[2,1,60,%lu]]}",
+          SIM_EPOCH + 300, SIM_EPOCH + 400, SIM_EPOCH + 1000, SIM_EPOCH + 1100, SIM_EPOCH + 1200);
+  CHECK(r.find(url) != std::string::npos);
+  // a reboot finds the same place
+  pd.init();
+  CHECK(pd.nlogs == 15);
+  CHECK(pd.log_find(SIM_EPOCH + 150, 1) == 12);
+  CHECK(pd.lastrun.endtime == SIM_EPOCH + 400);
+}
+
+static void test_wrap() {
+  unsigned int n = LOG_RECORDS;
+  // fill the ring so the set-back point moves to the oldest record, and past it
+  for (unsigned i = 0; i < n - 12; i++)  append(1, SIM_EPOCH + 500 + i * 10);
+  CHECK(pd.nlogs == n);
+  CHECK(pd.log_find(0, 1) == 7);
+  append(1, SIM_EPOCH + 500 + n * 10);
+  CHECK(pd.log_find(0, 1) == 6);
+  for (unsigned i = 0; i < 10; i++)  append(1, SIM_EPOCH + 500 + (n + 1 + i) * 10);
+  CHECK(pd.log_find(0, 1) == 0);
+  CHECK(pd.log_find(SIM_EPOCH + 500 + n * 10, 1) == n - 11);
+  pd.init();
+  CHECK(pd.log_find(0, 1) == 0);
+  CHECK(pd.log_find(SIM_EPOCH + 500 + n * 10, 1) == n - 11);
+}
+
+int main() {
+  sim_power_on(SIM_EPOCH);
+  if (LOG_RECORDS == 0) {
+    printf("no run log in this build\n");
+    return 0;
+  }
+  test_set_back();
+  test_wrap();
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("run log tests passed\n");
+  return 0;
+}
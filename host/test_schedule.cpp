@@ -0,0 +1,92 @@
+// Tests of the compiled start table (ProgramData::schedule_next):
+// every start is handed out exactly once, in program order, also when
+// more programs start in one minute than the table holds and when it
+// is rebuilt part way through a minute.
+
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include "harness.h"
+
+static int failures;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    failures++; \
+  } } while (0)
+
+#define T_0600  (SIM_EPOCH + 6*3600)
+
+static void add_daily(byte n, uint16_t at) {
+  for (byte i = 0; i < n; i++)  sim_add_program(0x7f, 0, at, at, 1, 60, 1 << (i % 8));
+}
+
+// the programs returned for minute t, until SCHEDULE_NONE (at most 'max')
+static int take(time_t t, byte *pids, int max) {
+  int n = 0;
+  byte pid;
+  while (n < max && (pid = pd.schedule_next(t)) != SCHEDULE_NONE)  pids[n++] = pid;
+  return n;
+}
+
+// whether pids[] counts up from 'first'
+static bool in_order(const byte *pids, int n, byte first) {
+  for (int i = 0; i < n; i++)
+    if (pids[i] != first + i)  return false;
+  return true;
+}
+
+static void test_more_starts_than_table() {
+  byte n = PROGRAM_SLOTS(svc.nboards) < 70 ? PROGRAM_SLOTS(svc.nboards) : 70;
+  byte pids[256];
+  pd.erase();
+  add_daily(n, 360);
+  CHECK(take(T_0600 - 60, pids, 256) == 0);
+  int got = take(T_0600, pids, 256);
+  CHECK(got == n);
+  CHECK(in_order(pids, got, 0));
+  CHECK(take(T_0600 + 30, pids, 256) == 0);
+  CHECK(take(T_0600 + 60, pids, 256) == 0);
+  printf("%d programs starting together: %d starts handed out\n", n, got);
+}
+
+static void test_rebuild_within_minute() {
+  byte pids[256];
+  pd.erase();
+  add_daily(10, 360);
+  CHECK(take(T_0600, pids, 4) == 4);
+  // a program change rebuilds the table part way through the minute
+  sim_add_program(0x7f, 0, 360, 360, 1, 60, 1);
+  int got = take(T_0600 + 20, pids, 256);
+  CHECK(got == 7);
+  CHECK(in_order(pids, got, 4));
+  // the next day starts afresh
+  CHECK(take(T_0600 + 86400, pids, 256) == 11);
+}
+
+// the whole controller gets past a minute where more programs start
+// than the table holds
+static void test_loop() {
+  byte n = PROGRAM_SLOTS(svc.nboards) < 70 ? PROGRAM_SLOTS(svc.nboards) : 70;
+  pd.erase();
+  add_daily(n, 360);
+  alarm(10);
+  sim_run_until(T_0600 + 120);
+  alarm(0);
+  CHECK(svc.status.program_busy);
+}
+
+int main() {
+  sim_power_on(SIM_EPOCH);
+  sim_set_option(OPTION_USE_NTP, 0);
+  test_more_starts_than_table();
+  test_rebuild_within_minute();
+  test_loop();
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("schedule tests passed\n");
+  return 0;
+}
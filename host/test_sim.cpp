@@ -0,0 +1,93 @@
+// Tests of the whole sketch on the virtual clock: scripted programs and
+// a rain delay turn the expected valves on and off at the expected
+// times, and the LCD shows the clock and the station bits.
+
+#include <stdio.h>
+#include <string.h>
+#include "harness.h"
+
+static int failures;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    failures++; \
+  } } while (0)
+
+#define HOUR  3600UL
+#define DAY   86400UL
+
+// valves of the first board that are on at 'at' seconds after SIM_EPOCH,
+// read off the pins: station_pins[s] drives bit 7-s
+static byte valves_at(unsigned long at) {
+  sim_run_until(SIM_EPOCH + at);
+  byte v = 0;
+  for (byte s = 0; s < 8; s++) {
+    int pin = svc.station_pins[s];
+    if (*portOutputRegister(digitalPinToPort(pin)) & digitalPinToBitMask(pin))  v |= 1 << (7-s);
+  }
+  return v;
+}
+
+static bool lcd_line(byte row, const char *text) {
+  return !memcmp(sim_lcd_ram[row], text, strlen(text));
+}
+
+// the station line as loop() draws it (the sketch shows free memory
+// there instead while SHOW_MEMORY is set)
+static bool lcd_stations(const char *text) {
+  svc.lcd_print_station(1, 'o');
+  return lcd_line(1, text);
+}
+
+static void test_programs() {
+  // daily at 6:00 on stations 1 and 2, run one after the other
+  sim_add_program(0x7f, 0, 360, 360, 1, 300, 0x03);
+  // Mondays at 7:00 on station 3
+  sim_add_program(0x01, 0, 420, 420, 1, 600, 0x04);
+
+  CHECK(valves_at(6*HOUR - 1) == 0x00);
+  CHECK(valves_at(6*HOUR + 1) == 0x01);
+  CHECK(lcd_line(0, "06:00  Tue 10-01"));
+  CHECK(lcd_stations("MC:o_______"));
+  CHECK(valves_at(6*HOUR + 299) == 0x01);
+  CHECK(valves_at(6*HOUR + 301) == 0x02);
+  CHECK(lcd_stations("MC:_o______"));
+  CHECK(valves_at(6*HOUR + 601) == 0x00);
+  CHECK(lcd_stations("MC:________"));
+  CHECK(valves_at(7*HOUR + 1) == 0x00);        // a Tuesday
+}
+
+static void test_rain_delay() {
+  // a day's rain delay from Tuesday noon keeps the valves shut through
+  // Wednesday's run, which goes on without them
+  sim_run_until(SIM_EPOCH + 12*HOUR);
+  CHECK(sim_http("/cv?pw=spectrum&rd=24").find("200 OK") != std::string::npos);
+  CHECK(valves_at(DAY + 6*HOUR + 1) == 0x00);
+  CHECK(svc.status.rain_delayed);
+  CHECK(svc.station_bits[0] == 0x01);
+  CHECK(lcd_stations("-Rain Stop-"));
+  CHECK(valves_at(2*DAY + 6*HOUR + 1) == 0x01);
+  CHECK(!svc.status.rain_delayed);
+  CHECK(lcd_line(0, "06:00  Thu 10-03"));
+}
+
+static void test_weekday() {
+  // the Monday program starts after the daily one on 10-07
+  CHECK(valves_at(6*DAY + 6*HOUR + 301) == 0x02);
+  CHECK(valves_at(6*DAY + 7*HOUR + 1) == 0x04);
+  CHECK(lcd_line(0, "07:00  Mon 10-07"));
+  CHECK(lcd_stations("MC:__o_____"));
+  CHECK(valves_at(6*DAY + 7*HOUR + 599) == 0x04);
+  CHECK(valves_at(6*DAY + 7*HOUR + 601) == 0x00);
+}
+
+int main() {
+  sim_power_on(SIM_EPOCH);
+  test_programs();
+  test_rain_delay();
+  test_weekday();
+  if (failures)  return 1;
+  printf("simulator tests passed\n");
+  return 0;
+}
@@ -34,11 +34,13 @@
      - Any old DS1307 compatible Real Time Clock ($2.45 inc postage off ebay)
      
      - Any old relay card that can be driven from Arduino digitial output 
-       using a couple of pins and a shift register). An an alternative,
-       you can use, say, 8 regular digital outputs for control signal to 
-       trigger your relay- just search for comments labelled "shift register"
-       and/or "digital outputs" in OpenSprinklerGen2.h, OpenSprinklerGen2.cpp, 
-       and defines.h and swap the commented sections around.
+       using a couple of pins and a shift register). By default the
+       stations use 8 regular digital outputs (PIN_STN_S1..S8) for control
+       signal to trigger your relay. For a chain of 74HC595 shift registers
+       (one per board, needed for extension boards) uncomment
+       SHIFT_REGISTER_OUTPUT in defines.h, and wire data and clock to the
+       SPI pins (MOSI 51, SCK 52), latch to PIN_SR_LATCH and output
+       enable to PIN_SR_OE.
        
      - Power supplies(s), ethernet switch, bits & pieces to hook it all up 
        
@@ -54,7 +56,7 @@
           <SPI.h>           Standard Arduino Library
           <Ethernet.h>      Standard Arduino Library
           <EthernetUdp.h>   Standard Arduino Library
-          <ICMPPing.h>      https://github.com/BlakeFoster/Arduino-Ping (because I'm too lazy to write my own ping code - well done Blake! )
+          <SD.h>            Standard Arduino Library (only with SD_PROGRAM_STORE in defines.h)
           <Time.h>          http://playground.arduino.cc/Code/time which links to http://www.pjrc.com/teensy/td_libs_Time.html 
           <TimeAlarms.h>    http://playground.arduino.cc/Code/time which links to http://www.pjrc.com/teensy/td_libs_TimeAlarms.html 
           <DS1307RTC.h>     http://playground.arduino.cc/Code/time which links to http://www.pjrc.com/teensy/td_libs_DS1307RTC.html
@@ -67,13 +69,20 @@
 
     3. Assuming you have the libraries above installed, the code here 
        *should* compile without too many issues (good luck!)
+
+    4. The host/ folder next to this sketch builds the same code for a
+       PC (make -C host, needs g++ and python3), with the libraries
+       above replaced by in-memory stand-ins. bin/sim replays a year of
+       watering in a few seconds against a virtual clock and prints
+       every valve change; see the top of host/sim.cpp.
        
   ============================================================== 
   
   Issues and Limitations:
 
     - hostname isn't implemented for opensprinkler - you'll need to use IP to access
-      (this seems to be a limitation of the Arduino Ethernet library)
+      (the name is sent along with DHCP requests, so some routers will
+      resolve it, but there is no DNS of our own)
       
     - port number is currently hard coded (default is 80) until i figure out how to
       change it dynamically when defining the EthernetServer object
@@ -15,6 +15,8 @@
 #include "EtherCard_W5100.h"
 #include <stdarg.h>
 #include <avr/eeprom.h>
+#include <utility/w5100.h>
+#include <utility/socket.h>
 
 //================================================================
 
@@ -26,27 +28,34 @@ void BufferFiller::emit_p(PGM_P fmt, ...) {
     if (c == 0)
       break;
     if (c != '$') {
-      *ptr++ = c;
+      put(c);
       continue;
     }
     c = pgm_read_byte(fmt++);
     switch (c) {
     case 'D':
       //wtoa(va_arg(ap, word), (char*) ptr);  //ray
+      reserve(7);
       itoa(va_arg(ap, word), (char*) ptr, 10);
       break;
     case 'L':
+      reserve(11);
       ultoa(va_arg(ap, long), (char*) ptr, 10);
       break;
-    case 'S':
-      strcpy((char*) ptr, va_arg(ap, const char*));
-      break;
+    case 'S': 
+      {
+        const char* s = va_arg(ap, const char*);
+        char d;
+        while ((d = *s++) != 0)
+          put(d);
+        continue;
+      }
     case 'F': 
       {
         PGM_P s = va_arg(ap, PGM_P);
         char d;
         while ((d = pgm_read_byte(s++)) != 0)
-          *ptr++ = d;
+          put(d);
         continue;
       }
     case 'E': 
@@ -54,11 +63,11 @@ void BufferFiller::emit_p(PGM_P fmt, ...) {
         byte* s = va_arg(ap, byte*);
         char d;
         while ((d = eeprom_read_byte(s++)) != 0)
-          *ptr++ = d;
+          put(d);
         continue;
       }
     default:
-      *ptr++ = c;
+      put(c);
       continue;
     }
     ptr += strlen((char*) ptr);
@@ -87,12 +96,63 @@ extern BufferFiller bfill;
 extern char tmp_buffer[];
 extern EthernetServer server;
 extern EthernetUDP udp;
-extern ICMPPing ping;
+
+EthernetClient client;  // client currently being served
+
+// Send the filled part of the buffer to the client
+void BufferFiller::flush() {
+  if (ptr > start)  client.write(start, ptr - start);
+  ptr = start;
+}
+
+// One entry per W5100 socket. Connections are accepted and closed
+// side by side. A request stays in its socket buffer on the W5100 while
+// it arrives, and is read into the shared packet buffer only once all
+// of it is there, so a slow client holds up no one else.
+static ConnStruct conns[MAX_SOCK_NUM];
+static byte reader = MAX_SOCK_NUM;  // socket that owns the buffer
+static byte last_reader;            // for round-robin
+static uint16_t req_len;          // bytes in buffer, including TCP_OFFSET
+static byte req_eoh;              // how much of "\r\n\r\n" has been seen
+static uint16_t req_body;         // where the body starts, 0 until the headers are in
+static uint16_t req_end;          // where the body ends (Content-Length)
+
+static byte icmp_sock = MAX_SOCK_NUM;  // socket borrowed for the gateway check
+static uint16_t icmp_seq;
+
+static EthernetUDP dhcp_udp;
+static byte dhcp_state = DHCP_IDLE;
+static unsigned long dhcp_since;  // millis() when the last message went out
+static uint32_t dhcp_xid;
+static byte dhcp_offer[4];        // address offered by the server
+static const char *dhcp_name;
+
+// Drop every socket, before the interface is (re)configured
+static void net_reset () {
+  udp.stop();
+  dhcp_udp.stop();
+  icmp_sock = MAX_SOCK_NUM;
+  for (byte sock = 0; sock < MAX_SOCK_NUM; sock++) {
+    if (W5100.readSnSR(sock) != SnSR::CLOSED)  close(sock);
+    EthernetClass::_server_port[sock] = 0;
+    conns[sock].state = CONN_FREE;
+  }
+  reader = MAX_SOCK_NUM;
+}
 
 uint8_t EtherCard::begin (const uint16_t size,
 const uint8_t* macaddr,
 uint8_t csPin) {
+  static bool initialised = false;
+
   copyMac(mymac, macaddr);
+  // the chip is reset only once (that takes a while),
+  // a reconnect just configures it again
+  if (!initialised) {
+    W5100.init();
+    initialised = true;
+  }
+  W5100.setMACAddress(mymac);
   return 1; //0 means fail
 }
 
@@ -100,39 +160,244 @@ bool EtherCard::staticSetup (const uint8_t* my_ip,
 const uint8_t* gw_ip,
 const uint8_t* dns_ip) {
 
-  // initialize the ethernet device
-  Ethernet.begin(mymac, my_ip, dns_ip, gw_ip);
+  net_reset();
+  dhcp_state = DHCP_IDLE;
+
+  // same defaults as Ethernet.begin(): class C net mask,
+  // gateway doubles as dns server if none is given
+  copyIp(myip, my_ip);
+  copyIp(gwip, gw_ip);
+  copyIp(dnsip, dns_ip ? dns_ip : gw_ip);
+  mymask[0] = mymask[1] = mymask[2] = 255;
+  mymask[3] = 0;
+  W5100.setIPAddress(myip);
+  W5100.setGatewayIp(gwip);
+  W5100.setSubnetMask(mymask);
 
   // start listening for clients
   server.begin();
-  for (int i = 0; i < 4; i++)
-  {
-    myip[i] = Ethernet.localIP()[i];
-    gwip[i] = Ethernet.gatewayIP()[i];
-    dnsip[i] = Ethernet.dnsServerIP()[i];
-    mymask[i] = Ethernet.subnetMask()[i];
-  }
   return true;
 }
 
+//=================================================================================
+// DHCP client. Runs in the background: dhcpSetup() sends a discover and
+// returns, packetLoop() drives the rest until a lease is obtained.
+
+static void dhcp_send (byte type) {
+  byte b[28];
+
+  dhcp_udp.beginPacket(IPAddress(255, 255, 255, 255), DHCP_SERVER_PORT);
+  memset(b, 0, sizeof(b));
+  b[0] = 1;                 // boot request
+  b[1] = 1;                 // ethernet
+  b[2] = 6;                 // hardware address length
+  memcpy(b + 4, &dhcp_xid, 4);
+  b[10] = 0x80;             // ask for the reply to be broadcast, we have no address yet
+  dhcp_udp.write(b, 28);    // op .. giaddr
+  dhcp_udp.write(EtherCard::mymac, 6);
+  // rest of chaddr, sname and file are all zero
+  memset(b, 0, sizeof(b));
+  for (byte i = 0; i < 202 / 2; i++)
+    dhcp_udp.write(b, 2);
+
+  // magic cookie, then options
+  b[0] = 99;  b[1] = 130;  b[2] = 83;  b[3] = 99;
+  b[4] = 53;  b[5] = 1;  b[6] = type;
+  b[7] = 61;  b[8] = 7;  b[9] = 1;
+  memcpy(b + 10, EtherCard::mymac, 6);
+  dhcp_udp.write(b, 16);
+  if (type == DHCP_REQUEST) {
+    b[0] = 50;  b[1] = 4;
+    memcpy(b + 2, dhcp_offer, 4);
+    b[6] = 54;  b[7] = 4;
+    memcpy(b + 8, EtherCard::dhcpip, 4);
+    dhcp_udp.write(b, 12);
+  }
+  if (dhcp_name) {
+    b[0] = 12;  b[1] = strlen(dhcp_name);
+    dhcp_udp.write(b, 2);
+    dhcp_udp.write((const uint8_t*) dhcp_name, b[1]);
+  }
+  b[0] = 55;  b[1] = 3;  b[2] = 1;  b[3] = 3;  b[4] = 6;  // want net mask, router, dns
+  b[5] = 255;
+  dhcp_udp.write(b, 6);
+  dhcp_udp.endPacket();
+  dhcp_since = millis();
+}
+
+// Read a reply if one is waiting. Returns its message type,
+// or 0 if there is none or it is not meant for us.
+static byte dhcp_receive () {
+  byte b[34];
+  byte type = 0;
+  int code, len;
+
+  if (dhcp_udp.parsePacket() < 240)  return 0;
+  dhcp_udp.read(b, 34);     // op .. first 6 bytes of chaddr
+  if (b[0] != 2 || memcmp(b + 4, &dhcp_xid, 4) != 0 || memcmp(b + 28, EtherCard::mymac, 6) != 0)
+    return 0;
+  memcpy(dhcp_offer, b + 16, 4);
+  for (byte i = 0; i < 206 / 2; i++)  // rest of chaddr, sname, file and the cookie
+    dhcp_udp.read(b, 2);
+
+  while ((code = dhcp_udp.read()) != -1 && code != 255) {
+    if (code == 0)  continue;
+    len = dhcp_udp.read();
+    if (len < 0)  break;
+    // only the first 4 bytes of an option are of interest
+    dhcp_udp.read(b, len < 4 ? len : 4);
+    switch (code) {
+    case 53:
+      type = b[0];
+      break;
+    case 54:
+      EtherCard::copyIp(EtherCard::dhcpip, b);
+      break;
+    case 1:
+      EtherCard::copyIp(EtherCard::mymask, b);
+      break;
+    case 3:
+      EtherCard::copyIp(EtherCard::gwip, b);
+      break;
+    case 6:
+      EtherCard::copyIp(EtherCard::dnsip, b);
+      break;
+    }
+    for (len -= 4; len > 0; len--)
+      dhcp_udp.read();
+  }
+  return type;
+}
+
+static void dhcp_start () {
+  dhcp_udp.stop();
+  dhcp_udp.begin(DHCP_CLIENT_PORT);
+  dhcp_xid = micros();
+  dhcp_send(DHCP_DISCOVER);
+  dhcp_state = DHCP_SELECTING;
+}
+
+static void dhcp_poll () {
+  byte type = dhcp_receive();
+
+  if (dhcp_state == DHCP_SELECTING && type == DHCP_OFFER) {
+    dhcp_send(DHCP_REQUEST);
+    dhcp_state = DHCP_REQUESTING;
+  }
+  else if (dhcp_state == DHCP_REQUESTING && type == DHCP_ACK) {
+    // lease obtained, configure the interface and start serving
+    EtherCard::copyIp(EtherCard::myip, dhcp_offer);
+    W5100.setIPAddress(EtherCard::myip);
+    W5100.setGatewayIp(EtherCard::gwip);
+    W5100.setSubnetMask(EtherCard::mymask);
+    dhcp_udp.stop();
+    dhcp_state = DHCP_IDLE;
+    server.begin();
+  }
+  else if (dhcp_state == DHCP_REQUESTING && type == DHCP_NAK) {
+    dhcp_start();
+  }
+  else if (millis() - dhcp_since > DHCP_RESPONSE_TIMEOUT) {
+    dhcp_start();
+  }
+}
+
 // Initialise DHCP with a particular name.
 bool EtherCard::dhcpSetup (const char *name) 
 {
-  // initialize the ethernet device
-  if (Ethernet.begin(mymac) == 0)
-    return false;
+  net_reset();
+  memset(myip, 0, 4);
+  W5100.setIPAddress(myip);
+  dhcp_name = name;
+  dhcp_start();
+  return true; 
+}
 
-  // start listening for clients
-  server.begin();  
-  for (int i = 0; i < 4; i++)
-  {
-    myip[i] = Ethernet.localIP()[i];
-    gwip[i] = Ethernet.gatewayIP()[i];
-    dnsip[i] = Ethernet.dnsServerIP()[i];
-    mymask[i] = Ethernet.subnetMask()[i];
+// true while an address is still being obtained
+bool EtherCard::dhcpBusy () {
+  return dhcp_state != DHCP_IDLE;
+}
+
+//=================================================================================
+// Gateway check. The echo request is handed to the W5100 without waiting
+// for it to go out; the reply is looked for on later calls.
+
+static uint16_t icmp_checksum (const byte *p, byte len) {
+  uint32_t sum = 0;
+  for (byte i = 0; i < len; i += 2)
+    sum += ((uint16_t) p[i] << 8) | p[i+1];
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return ~sum;
+}
+
+// false if there was no socket free to send it on
+bool EtherCard::clientIcmpRequest (const uint8_t *destip) {
+  byte packet[ICMP_HEADER_SIZE + ICMP_DATA_SIZE];
+
+  if (icmp_sock == MAX_SOCK_NUM) {
+    // borrow a free socket for the duration of the check
+    for (byte sock = 0; sock < MAX_SOCK_NUM; sock++) {
+      if (conns[sock].state == CONN_FREE && W5100.readSnSR(sock) == SnSR::CLOSED) {
+        icmp_sock = sock;
+        break;
+      }
+    }
+    if (icmp_sock == MAX_SOCK_NUM)  return false;
+    W5100.writeSnPROTO(icmp_sock, IPPROTO::ICMP);
+    socket(icmp_sock, SnMR::IPRAW, 0, 0);
   }
 
-  return true; 
+  icmp_seq++;
+  packet[0] = ICMP_ECHO_REQUEST;
+  packet[1] = 0;
+  packet[2] = packet[3] = 0;
+  packet[4] = ICMP_PING_ID >> 8;
+  packet[5] = ICMP_PING_ID & 0xFF;
+  packet[6] = icmp_seq >> 8;
+  packet[7] = icmp_seq & 0xFF;
+  for (byte i = 0; i < ICMP_DATA_SIZE; i++)
+    packet[ICMP_HEADER_SIZE + i] = i;
+  uint16_t sum = icmp_checksum(packet, sizeof(packet));
+  packet[2] = sum >> 8;
+  packet[3] = sum & 0xFF;
+
+  W5100.writeSnDIPR(icmp_sock, (uint8_t*) destip);
+  W5100.writeSnIR(icmp_sock, SnIR::SEND_OK | SnIR::TIMEOUT);
+  W5100.send_data_processing(icmp_sock, packet, sizeof(packet));
+  W5100.execCmdSn(icmp_sock, Sock_SEND);
+  return true;
+}
+
+uint8_t EtherCard::packetLoopIcmpCheckReply (const uint8_t *ip_mh) {
+  // 6 bytes of W5100 header (source ip, length) come with each packet
+  byte packet[ICMP_HEADER_SIZE + ICMP_DATA_SIZE + 6];
+  byte addr[4];
+  uint16_t port;
+
+  if (icmp_sock == MAX_SOCK_NUM)  return 0;
+  uint16_t n = W5100.getRXReceivedSize(icmp_sock);
+  if (n == 0)  return 0;
+  if (n > sizeof(packet)) {
+    // not (only) our reply and more than fits here, drop it all
+    icmpClose();
+    return 0;
+  }
+  recvfrom(icmp_sock, packet, sizeof(packet), addr, &port);
+  if (memcmp(addr, ip_mh, 4) == 0 && packet[0] == ICMP_ECHO_REPLY &&
+      packet[4] == (ICMP_PING_ID >> 8) && packet[5] == (ICMP_PING_ID & 0xFF) &&
+      packet[6] == (icmp_seq >> 8) && packet[7] == (icmp_seq & 0xFF)) {
+    icmpClose();
+    return 1;
+  }
+  return 0;
+}
+
+// give the socket borrowed by clientIcmpRequest() back
+void EtherCard::icmpClose () {
+  if (icmp_sock == MAX_SOCK_NUM)  return;
+  close(icmp_sock);
+  icmp_sock = MAX_SOCK_NUM;
 }
 
 //=================================================================================
@@ -143,68 +408,211 @@ word EtherCard::packetReceive() {
   return 0;
 }
 
-EthernetClient client;
+
+// Start closing a connection. The FIN goes out after the reply data,
+// packetLoop() releases the socket once the close has completed.
+static void conn_close (byte sock) {
+  disconnect(sock);
+  conns[sock].state = CONN_CLOSING;
+  conns[sock].since = millis();
+  if (reader == sock)  reader = MAX_SOCK_NUM;
+}
+
+static prog_char content_length[] PROGMEM = "\ncontent-length:";
+
+// Look at what has arrived of a request without taking it out of the
+// socket buffer. True once all of it is there, or all that fits in the
+// packet buffer, or all that will ever come.
+static bool conn_scan (byte sock, ConnStruct &c) {
+  const uint16_t room = ETHER_BUFFER_SIZE - 1 - TCP_OFFSET;
+  byte chunk[16];
+  uint16_t n = W5100.getRXReceivedSize(sock);
+  if (n > room)  n = room;
+  uint16_t at = W5100.readSnRX_RD(sock);
+
+  if (c.scanned == 0 && n >= 8) {
+    // a GET has no body, so one that ends with the blank line is all
+    // there; looking at its ends saves going over all of it
+    W5100.read_data(sock, (uint8_t*) (uintptr_t) at, chunk, 4);
+    W5100.read_data(sock, (uint8_t*) (uintptr_t) (uint16_t) (at + n - 4), chunk + 4, 4);
+    if (memcmp_P(chunk, PSTR("GET \r\n\r\n"), 8) == 0) {
+      c.scanned = n;
+      c.eoh = 4;
+      return true;
+    }
+  }
+  at += c.scanned;
+
+  while (c.eoh < 4 && c.scanned < n) {
+    byte len = (n - c.scanned < (int) sizeof(chunk)) ? n - c.scanned : sizeof(chunk);
+    W5100.read_data(sock, (uint8_t*) (uintptr_t) at, chunk, len);
+    at += len;
+    for (byte i = 0; i < len && c.eoh < 4; i++) {
+      byte ch = chunk[i];
+      c.scanned++;
+      // the blank line that ends the headers
+      if (ch == ((c.eoh & 1) ? '\n' : '\r'))  c.eoh++;
+      else  c.eoh = (ch == '\r');
+      // a Content-Length header (names are case-insensitive)
+      if (c.match == sizeof(content_length) - 1) {
+        if (ch >= '0' && ch <= '9') {
+          if (c.body < ETHER_BUFFER_SIZE)  c.body = c.body * 10 + (ch - '0');
+        }
+        else if (ch == '\r' || ch == '\n')  c.match = (ch == '\n');
+      }
+      else if (tolower(ch) == pgm_read_byte(content_length + c.match))  c.match++;
+      else  c.match = (ch == '\n');
+    }
+  }
+
+  if (c.eoh == 4) {
+    // (a body announced larger than the buffer is not waited for)
+    uint16_t need = c.scanned + c.body;
+    if (need <= n || need > room)  return true;
+  }
+  return n == room || (n > 0 && W5100.readSnSR(sock) != SnSR::ESTABLISHED);
+}
+
+// Update the connection table from the socket status registers
+static void conn_poll () {
+  bool listening = false;
+  for (byte sock = 0; sock < MAX_SOCK_NUM; sock++) {
+    ConnStruct &c = conns[sock];
+    byte st = W5100.readSnSR(sock);
+    if (st == SnSR::LISTEN)  listening = true;
+
+    if (c.state == CONN_FREE && (st == SnSR::ESTABLISHED || st == SnSR::CLOSE_WAIT)) {
+      c.state = CONN_OPEN;
+      c.since = millis();
+      c.scanned = 0;
+      c.eoh = c.match = 0;
+      c.body = 0;
+    }
+
+    switch (c.state) {
+    case CONN_OPEN:
+      // a connection waiting for its turn is not timed out,
+      // only one that has not sent its request in time
+      if (conn_scan(sock, c)) {
+        c.state = CONN_READY;
+        c.since = millis();
+      }
+      else if (st != SnSR::ESTABLISHED || millis() - c.since > REQUEST_TIMEOUT)
+        conn_close(sock);
+      break;
+    case CONN_CLOSING:
+      if (st == SnSR::CLOSED || millis() - c.since > CLOSE_TIMEOUT) {
+        close(sock);
+        EthernetClass::_server_port[sock] = 0;
+        c.state = CONN_FREE;
+      }
+      break;
+    }
+  }
+  // keep a socket listening for the next client
+  if (!listening)  server.begin();
+}
 
 word EtherCard::packetLoop (word plen) 
 {  
-  // listen for incoming clients
-  client = server.available();
-  int i = 0;
-
-  if (client) 
-  {
-    // set all bytes in the buffer to 0 - add a 
-    // byte to simulate space for the TCP header
-    memset(buffer, 0, ETHER_BUFFER_SIZE);
-    memset(buffer, ' ', TCP_OFFSET);
-    i = TCP_OFFSET; // add a space for TCP offset
+  // nothing to serve until there is an address
+  if (dhcp_state != DHCP_IDLE) {
+    dhcp_poll();
+    return 0;
+  }
 
-    while (client.connected() && (i < ETHER_BUFFER_SIZE)) 
-    {
-      if (client.available()) 
-        buffer[i] = client.read();
+  conn_poll();
 
-      i++;
+  // hand the buffer to the next connection whose request is in
+  byte sock = last_reader;
+  for (byte i = 0; i < MAX_SOCK_NUM; i++) {
+    sock = (sock + 1) % MAX_SOCK_NUM;
+    if (conns[sock].state == CONN_READY)  break;
+  }
+  ConnStruct &c = conns[sock];
+  if (c.state != CONN_READY)  return 0;
+
+  reader = last_reader = sock;
+  c.state = CONN_READING;
+  c.since = millis();
+  client = EthernetClient(sock);
+
+  // add a byte to simulate space for the TCP header
+  memset(buffer, ' ', TCP_OFFSET);
+  int n = client.available();
+  if (n > ETHER_BUFFER_SIZE - 1 - TCP_OFFSET)
+    n = ETHER_BUFFER_SIZE - 1 - TCP_OFFSET;
+  n = client.read(buffer + TCP_OFFSET, n);
+  req_len = TCP_OFFSET + (n > 0 ? n : 0);
+  req_eoh = c.eoh;
+  req_body = req_end = 0;
+  if (req_eoh == 4) {
+    // a body (POST) follows if the headers announce one
+    req_body = req_end = TCP_OFFSET + c.scanned;
+    if (c.body) {
+      // only the request line is needed from here on, so move the
+      // body up over the other headers to leave it more room
+      buffer[req_len] = 0;
+      uint16_t keep = (byte*) strchr((char*) buffer, '\n') + 1 - buffer;
+      req_end = keep + c.body;
+      memmove(buffer + keep, buffer + req_body, req_len - req_body);
+      req_len -= req_body - keep;
+      req_body = keep;
     }
-    return TCP_OFFSET;
   }
-  return 0;
+  buffer[req_len] = 0;
+  return TCP_OFFSET;
+}
+
+// body of the request just returned by packetLoop(), empty if it has none
+char* EtherCard::requestBody () {
+  return (char*) buffer + (req_body ? req_body : req_len);
+}
+
+// true if the request just returned did not fit in the buffer
+// (or the client went away before sending all of it)
+bool EtherCard::requestTruncated () {
+  return req_eoh < 4 || req_len < req_end;
 }
 
 void EtherCard::httpServerReply (word dlen) {
 
-  // ignore dlen - just add a null termination 
-  // to the buffer and print it out to the client
-  buffer[bfill.position() + TCP_OFFSET] = '\0';
-  client.print((char*) bfill.buffer());
+  // ignore dlen - send what is left in the buffer
+  // (earlier parts have already been flushed by bfill)
+  bfill.flush();
 
-  // close the connection:   
-  delay(1);       // give the web browser time to receive the data 
-  client.stop();
+  // the close completes in the background
+  conn_close(reader);
 }
 
 void EtherCard::ntpRequest (byte *ntp_ip, byte srcport) {
 
+  // use a packet of its own so a request being read into
+  // the shared buffer is left alone
+  byte packet[NTP_PACKET_SIZE];
+
+  // release the socket of the previous request before opening a new one
+  udp.stop();
   udp.begin(srcport);
 
-  // set all bytes in the buffer to 0
-  memset(buffer, 0, ETHER_BUFFER_SIZE); 
+  // set all bytes in the packet to 0
+  memset(packet, 0, NTP_PACKET_SIZE); 
   // Initialize values needed to form NTP request
-  buffer[0] = 0b11100011;    // LI, Version, Mode
-  buffer[1] = 0;             // Stratum, or type of clock
-  buffer[2] = 6;             // Polling Interval
-  buffer[3] = 0xEC;          // Peer Clock Precision
+  packet[0] = 0b11100011;    // LI, Version, Mode
+  packet[1] = 0;             // Stratum, or type of clock
+  packet[2] = 6;             // Polling Interval
+  packet[3] = 0xEC;          // Peer Clock Precision
   // 8 bytes of zero for Root Delay & Root Dispersion
-  buffer[12]  = 49; 
-  buffer[13]  = 0x4E;
-  buffer[14]  = 49;
-  buffer[15]  = 52;
+  packet[12]  = 49; 
+  packet[13]  = 0x4E;
+  packet[14]  = 49;
+  packet[15]  = 52;
 
   ntpip = IPAddress(ntp_ip[0], ntp_ip[1], ntp_ip[2], ntp_ip[3]);
 
   // all NTP fields have been given values, now you can send a packet requesting a timestamp: 		   
   udp.beginPacket(ntpip, 123); //NTP requests are to port 123
-  udp.write(buffer, NTP_PACKET_SIZE);
+  udp.write(packet, NTP_PACKET_SIZE);
   udp.endPacket(); 
 }
 
@@ -213,22 +621,30 @@ byte EtherCard::ntpProcessAnswer (uint32_t *time, byte dstport_l) {
   int packetSize = udp.parsePacket();
   if(packetSize)
   {
+    byte packet[NTP_PACKET_SIZE];
+
     // check the packet is from the correct timeserver IP and port
     if ( udp.remotePort() != 123 || udp.remoteIP() != ntpip)
       return 0;
 
     //the timestamp starts at byte 40 of the received packet and is four bytes, or two words, long. 
-    udp.read(buffer, packetSize);
-    ((byte*) time)[3] = buffer[40];
-    ((byte*) time)[2] = buffer[41];
-    ((byte*) time)[1] = buffer[42];
-    ((byte*) time)[0] = buffer[43];
+    if (udp.read(packet, NTP_PACKET_SIZE) < 44)
+      return 0;
+    ((byte*) time)[3] = packet[40];
+    ((byte*) time)[2] = packet[41];
+    ((byte*) time)[1] = packet[42];
+    ((byte*) time)[0] = packet[43];
 
     return 1;
   }  
   return 0;
 }
 
+// give the socket of the last request back, once answered or given up on
+void EtherCard::ntpClose () {
+  udp.stop();
+}
+
 //=================================================================================
 // Some common utilities needed for IP and web applications
 // Author: Guido Socher
@@ -286,6 +702,50 @@ byte EtherCard::findKeyVal (const char *str,char *strbuf, byte maxlen,const char
   return(i);
 }
 
+// Index of the query string of the current request. queryParse() splits
+// "key=value&key=value" in place into '\0' terminated keys and values,
+// url decodes the values, and keeps the keys sorted so queryValue() can
+// binary search them. The value of a key follows its terminating '\0'.
+// With append set, the keys are added to those already indexed.
+// As with findKeyVal(), a key with an empty value counts as missing.
+static char *query_keys[QUERY_MAX_KEYS];
+static byte query_nkeys;
+
+byte EtherCard::queryParse (char *str, bool append)
+{
+  if (!append)  query_nkeys = 0;
+  while (*str) {
+    char *key = str;
+    while (*str && *str != '&')  str++;
+    if (*str)  *str++ = 0;
+
+    char *val = strchr(key, '=');
+    if (val == NULL || val[1] == 0 || query_nkeys == QUERY_MAX_KEYS)  continue;
+    *val++ = 0;
+    urlDecode(val);
+
+    // insert after any equal keys, so the first one sent is found first
+    byte i = query_nkeys++;
+    for (; i > 0 && strcmp(query_keys[i-1], key) > 0; i--)
+      query_keys[i] = query_keys[i-1];
+    query_keys[i] = key;
+  }
+  return query_nkeys;
+}
+
+// value of key in the indexed query string, NULL if it is not there
+char* EtherCard::queryValue (const char *key)
+{
+  byte lo = 0, hi = query_nkeys;
+  while (lo < hi) {
+    byte mid = (lo + hi) / 2;
+    if (strcmp(query_keys[mid], key) < 0)  lo = mid + 1;
+    else  hi = mid;
+  }
+  if (lo == query_nkeys || strcmp(query_keys[lo], key) != 0)  return NULL;
+  return query_keys[lo] + strlen(query_keys[lo]) + 1;
+}
+
 // convert a single hex digit character to its integer value
 unsigned char h2int(char c)
 {
@@ -33,7 +33,6 @@
 #include <SPI.h>
 #include <Ethernet.h>
 #include <EthernetUdp.h>
-#include <ICMPPing.h>
 
 #define MAX_SOCK_NUM        4
 #define ETHER_BUFFER_SIZE   1100  // if buffer size is increased, you must check the total RAM consumption
@@ -41,28 +40,70 @@
 //#define WEBPREFIX           ""    //By specifying a prefix of "", all pages will be at the root of the server.
 #define NTP_PACKET_SIZE     48    // NTP time stamp is in the first 48 bytes of the message
 #define TCP_OFFSET          1
+#define QUERY_MAX_KEYS      64    // most keys indexed per request (/cs sends one per station)
+#define REQUEST_TIMEOUT     3000  // drop a client that takes longer than this (ms) to send its request
+#define CLOSE_TIMEOUT       1000  // force a socket closed if the peer has not finished closing by then (ms)
+
+// connection states, one per W5100 socket
+#define CONN_FREE           0     // not a connection of ours
+#define CONN_OPEN           1     // accepted, request still arriving
+#define CONN_READY          2     // whole request in the socket buffer, waiting for its turn
+#define CONN_READING        3     // request read into the buffer, being served
+#define CONN_CLOSING        4     // reply sent, close in progress
+
+// gateway check (ICMP echo)
+#define ICMP_ECHO_REQUEST   8
+#define ICMP_ECHO_REPLY     0
+#define ICMP_PING_ID        0x4F53  // 'OS', identifies our echo requests
+#define ICMP_HEADER_SIZE    8
+#define ICMP_DATA_SIZE      16
+
+// DHCP client
+#define DHCP_SERVER_PORT      67
+#define DHCP_CLIENT_PORT      68
+#define DHCP_RESPONSE_TIMEOUT 4000  // start over if the server has not answered within this (ms)
+#define DHCP_DISCOVER       1
+#define DHCP_OFFER          2
+#define DHCP_REQUEST        3
+#define DHCP_ACK            5
+#define DHCP_NAK            6
+
+// DHCP client states
+#define DHCP_IDLE           0     // address in place (static, or lease obtained)
+#define DHCP_SELECTING      1     // discover sent, waiting for an offer
+#define DHCP_REQUESTING     2     // request sent, waiting for the ack
+
+struct ConnStruct {
+  byte state;
+  unsigned long since;  // millis() of the last state change
+  // what has arrived of the request, looked at in the socket buffer
+  uint16_t scanned;     // bytes looked at (the header length once eoh is 4)
+  byte eoh;             // how much of "\r\n\r\n" has been seen
+  byte match;           // how much of "\ncontent-length:" has been seen
+  uint16_t body;        // Content-Length
+};
 
 class BufferFiller : 
 public Print 
 {
-  uint8_t *start, *ptr;
+  uint8_t *start, *ptr, *limit;
 public:
   BufferFiller () {
   }
   BufferFiller (uint8_t* buf) : 
-  start (buf), ptr (buf) {
+  start (buf), ptr (buf), limit (buf + ETHER_BUFFER_SIZE - TCP_OFFSET) {
   }
 
   void emit_p (PGM_P fmt, ...);
 
   void emit_raw (const char* s, uint16_t n) { 
-    memcpy(ptr, s, n); 
-    ptr += n; 
+    while (n--)
+      put(*s++);
   }
 
   void emit_raw_p (PGM_P p, uint16_t n) { 
-    memcpy_P(ptr, p, n); 
-    ptr += n; 
+    while (n--)
+      put(pgm_read_byte(p++));
   }
 
   uint8_t* buffer () const { 
@@ -73,9 +114,24 @@ public:
     return ptr - start; 
   }
 
+  // send what has been filled so far to the client and start over,
+  // so a page is not limited by the buffer size
+  void flush ();
+
   virtual WRITE_RESULT write (uint8_t v) { 
-    *ptr++ = v; 
+    put(v);
     WRITE_RETURN         }
+
+private:
+  void put (uint8_t c) {
+    if (ptr >= limit)  flush();
+    *ptr++ = c;
+  }
+
+  // make sure there is room for n more bytes
+  void reserve (uint16_t n) {
+    if (limit - ptr < n)  flush();
+  }
 };
 
 //=====================================================
@@ -99,14 +155,23 @@ public:
   static bool staticSetup (const uint8_t* my_ip =0, const uint8_t* gw_ip =0, const uint8_t* dns_ip =0);
   static uint16_t packetLoop (uint16_t plen);
   static void httpServerReply (uint16_t dlen);
+  static char* requestBody ();
+  static bool requestTruncated ();
   static void ntpRequest (uint8_t *ntpip,uint8_t srcport);
   static uint8_t ntpProcessAnswer (uint32_t *time, uint8_t dstport_l);
+  static void ntpClose ();
   static bool dhcpSetup (const char *);
+  static bool dhcpBusy ();
+  static bool clientIcmpRequest (const uint8_t *destip);
+  static uint8_t packetLoopIcmpCheckReply (const uint8_t *ip_mh);
+  static void icmpClose ();
 
   // webutil.cpp
   static void copyIp (uint8_t *dst, const uint8_t *src);
   static void copyMac (uint8_t *dst, const uint8_t *src);
   static uint8_t findKeyVal(const char *str,char *strbuf, uint8_t maxlen, const char *key);
+  static uint8_t queryParse(char *str, bool append =false);
+  static char* queryValue(const char *key);
   static void urlDecode(char *urlbuf);
   static  void urlEncode(char *str,char *urlbuf);
   static uint8_t parseIp(uint8_t *bytestr,char *str);
@@ -120,10 +185,6 @@ public:
 
   //======================= NOT IMPLEMENTED ==============================
   /*
-  // ethercard.cpp
-  static uint8_t packetLoopIcmpCheckReply (const uint8_t *ip_mh);
-  static void clientIcmpRequest (const uint8_t *destip);
-  
   // tcpip.cpp
    static void initIp (uint8_t *myip,uint16_t wwwp);
    static void makeUdpReply (char *data,uint8_t len, uint16_t port);
@@ -8,17 +8,39 @@
 #include "OpenSprinklerGen2.h"
 
 // Declare static data members
-LiquidCrystal OpenSprinkler::lcd(PIN_LCD_RS, PIN_LCD_EN, PIN_LCD_D4, PIN_LCD_D5, PIN_LCD_D6, PIN_LCD_D7);
+LiquidCrystal OpenSprinkler::lcd_hw(PIN_LCD_RS, PIN_LCD_EN, PIN_LCD_D4, PIN_LCD_D5, PIN_LCD_D6, PIN_LCD_D7);
+LcdShadow OpenSprinkler::lcd(&OpenSprinkler::lcd_hw);
 StatusBits OpenSprinkler::status;
 byte OpenSprinkler::nboards;
 byte OpenSprinkler::nstations;
 byte OpenSprinkler::station_bits[MAX_EXT_BOARDS+1];
 byte OpenSprinkler::masop_bits[MAX_EXT_BOARDS+1];
 unsigned long OpenSprinkler::raindelay_stop_time;
+EepromStats OpenSprinkler::eeprom_stats[NUM_EEPROM_REGIONS];
+ProbeStats OpenSprinkler::probes[NUM_PROBES];
+unsigned int OpenSprinkler::stack_max = 0;
 
 //===== Digital Outputs =====// 
 int OpenSprinkler::station_pins[8] = {
   PIN_STN_S1, PIN_STN_S2, PIN_STN_S3, PIN_STN_S4, PIN_STN_S5, PIN_STN_S6, PIN_STN_S7, PIN_STN_S8};
+byte OpenSprinkler::output_bits[MAX_EXT_BOARDS+1];
+byte OpenSprinkler::nports;
+volatile uint8_t *OpenSprinkler::out_port[8];
+byte OpenSprinkler::pin_port[8];
+byte OpenSprinkler::pin_mask[8];
+
+//===== Inputs =====//
+// Event ring: only the interrupt writes input_head and only the main
+// loop writes input_tail, so neither side has to block the other. The
+// indices run freely and are masked on access, so head-tail is the
+// number of events queued.
+static volatile byte input_queue[INPUT_QUEUE_SIZE];
+static volatile byte input_head, input_tail;
+// debounced state of the inputs
+static volatile byte input_key;   // button that is down, BUTTON_NONE if none
+static volatile byte input_rain;  // rain sensor pin level
+static volatile uint8_t *rain_in; // input register of the rain sensor pin
+static byte rain_mask;
 
 // Option names
 prog_char _str_fwv [] PROGMEM = "Firmware ver.";
@@ -105,12 +127,29 @@ char* OpenSprinkler::days_str[7] = {
   str_day6
 };
 
+// RAM taken by the static data above, for the memory report: a static
+// added to this file must be added to the list too
+unsigned int OpenSprinkler::ram_size() {
+  return sizeof(lcd_hw) + sizeof(lcd) + sizeof(status) + sizeof(nboards) + sizeof(nstations) +
+         sizeof(options) + sizeof(days_str) + sizeof(station_bits) + sizeof(masop_bits) +
+         sizeof(raindelay_stop_time) + sizeof(eeprom_stats) + sizeof(probes) +
+         sizeof(stack_max) + sizeof(station_pins) + sizeof(output_bits) + sizeof(nports) +
+         sizeof(out_port) + sizeof(pin_port) + sizeof(pin_mask) +
+         sizeof(input_queue) + sizeof(input_head) + sizeof(input_tail) + sizeof(input_key) +
+         sizeof(input_rain) + sizeof(rain_in) + sizeof(rain_mask);
+}
+
 // ===============
 // Setup Functions
 // ===============
 
 // Arduino software reset function
+// (jumps to the reset vector; off-target builds provide their own)
+#if defined(__AVR__)
 void(* resetFunc) (void) = 0;
+#else
+extern void(* resetFunc) (void);
+#endif
 
 // Initialize network with the given mac address and http port
 byte OpenSprinkler::start_network(byte mymac[], int http_port) {
@@ -148,43 +187,20 @@ void OpenSprinkler::reboot() {
 // OpenSprinkler init function
 void OpenSprinkler::begin() {
 
-  //===== Shift Register =====//
-  /*
-  // shift register setup
-   pinMode(PIN_SR_LATCH, OUTPUT);
-   pinMode(PIN_SR_OE, OUTPUT);
-   pinMode(PIN_SR_CLOCK, OUTPUT);
-   pinMode(PIN_SR_DATA,  OUTPUT);
-   
-   digitalWrite(PIN_SR_LATCH, HIGH);
-   // pull shift register OE high to disable output
-   digitalWrite(PIN_SR_OE, HIGH);
-   */
-
-  //===== Digital Outputs =====// 
-  // initialize the pins as outputs:
-  pinMode(PIN_STN_S1, OUTPUT); 
-  pinMode(PIN_STN_S2, OUTPUT);
-  pinMode(PIN_STN_S3, OUTPUT); 
-  pinMode(PIN_STN_S4, OUTPUT); 
-  pinMode(PIN_STN_S5, OUTPUT); 
-  pinMode(PIN_STN_S6, OUTPUT); 
-  pinMode(PIN_STN_S7, OUTPUT); 
-  pinMode(PIN_STN_S8, OUTPUT); 
+  //===== Station Outputs =====// 
+  // shift registers or digital pins, all off
+  outputs_setup();
   //===========================//
 
   // Reset all stations
   clear_all_station_bits();
   apply_all_station_bits();
 
-  //===== Shift Register =====//
-  /*  
-   // pull shift register OE low to enable output
-   digitalWrite(PIN_SR_OE, LOW);
-   */
-
   // set PWM frequency for LCD
+  // (timer registers only exist on the AVR target)
+#if defined(__AVR__)
   TCCR1B = 0x01;
+#endif
   // turn on LCD backlight and contrast
   pinMode(PIN_LCD_BACKLIGHT, OUTPUT);
   pinMode(PIN_LCD_CONTRAST, OUTPUT);
@@ -192,7 +208,7 @@ void OpenSprinkler::begin() {
   analogWrite(PIN_LCD_BACKLIGHT, 255-options[OPTION_LCD_BACKLIGHT].value); 
 
   // begin lcd
-  lcd.begin(16, 2);
+  lcd.begin(LCD_COLS, LCD_ROWS);
 
   // Rain sensor port set up
   pinMode(PIN_RAINSENSOR, INPUT);
@@ -253,6 +269,9 @@ void OpenSprinkler::begin() {
   if (RTC.chipPresent()==0) {
     status.has_rtc = 1;
   }
+
+  // start sampling the buttons and rain sensor
+  input_setup();
 }
 
 // Self_test function
@@ -263,6 +282,7 @@ void OpenSprinkler::self_test(unsigned long ms) {
       lcd.clear();
       lcd.setCursor(0, 0);
       lcd.print((int)sid+1);
+      lcd.flush();
       clear_all_station_bits();
       set_station_bit(sid, 1);
       apply_all_station_bits();
@@ -278,7 +298,7 @@ void OpenSprinkler::get_station_name(byte sid, char tmp[]) {
   int start = ADDR_EEPROM_STN_NAMES + (int)sid * STATION_NAME_SIZE;
   tmp[STATION_NAME_SIZE]=0;
   while(1) {
-    tmp[i] = eeprom_read_byte((unsigned char *)(start+i));
+    tmp[i] = eeprom_read_byte((unsigned char *)(uintptr_t)(start+i));
     if (tmp[i]==0 || i==(STATION_NAME_SIZE-1)) break;
     i++;
   }
@@ -290,20 +310,14 @@ void OpenSprinkler::set_station_name(byte sid, char tmp[]) {
   int i=0;
   int start = ADDR_EEPROM_STN_NAMES + (int)sid * STATION_NAME_SIZE;
   tmp[STATION_NAME_SIZE]=0;
-  while(1) {
-    eeprom_write_byte((unsigned char *)(start+i), tmp[i]);
-    if (tmp[i]==0 || i==(STATION_NAME_SIZE-1)) break;
-    i++;
-  }
+  while(tmp[i]!=0 && i<(STATION_NAME_SIZE-1))  i++;
+  eeprom_put(start, tmp, i+1);
   return;  
 }
 
 // Save station master operation bits to eeprom
 void OpenSprinkler::masop_save() {
-  byte i;
-  for(i=0;i<=MAX_EXT_BOARDS;i++) {
-    eeprom_write_byte((unsigned char *)ADDR_EEPROM_MAS_OP+i, masop_bits[i]);
-  }
+  eeprom_put(ADDR_EEPROM_MAS_OP, masop_bits, MAX_EXT_BOARDS+1);
 }
 
 // Load station master operation bits from eeprom
@@ -346,44 +360,83 @@ void OpenSprinkler::clear_all_station_bits() {
 // Apply all station bits
 // !!! This will activate/deactivate valves !!!
 void OpenSprinkler::apply_all_station_bits() {
+  byte bits[MAX_EXT_BOARDS+1];
+  byte bid;
+  boolean active = (status.enabled && (!status.rain_delayed) && !(options[OPTION_USE_RAINSENSOR].value && status.rain_sensed));
 
+  for(bid=0;bid<=MAX_EXT_BOARDS;bid++)
+    bits[bid] = active ? station_bits[bid] : 0;
+  if (memcmp(bits, output_bits, sizeof(bits)) == 0)  return;
+
+#ifdef SHIFT_REGISTER_OUTPUT
   //===== Shift Register =====//
-  /*
-  digitalWrite(PIN_SR_LATCH, LOW);
-   
-   byte bid, s;
-   byte bitvalue;
-   
-   // Shift out all station bit values
-   // from the highest bit to the lowest
-   for(bid=0;bid<=MAX_EXT_BOARDS;bid++) {
-   bitvalue = 0;
-   if (status.enabled && (!status.rain_delayed) && !(options[OPTION_USE_RAINSENSOR].value && status.rain_sensed))
-   bitvalue = station_bits[MAX_EXT_BOARDS-bid];
-   for(s=0;s<8;s++) {
-   digitalWrite(PIN_SR_CLOCK, LOW);
-   digitalWrite(PIN_SR_DATA, (bitvalue & ((byte)1<<(7-s))) ? HIGH : LOW );
-   digitalWrite(PIN_SR_CLOCK, HIGH);          
-   }
-   }
-   digitalWrite(PIN_SR_LATCH, HIGH); 
-   */
+  shift_out(bits);
+#else
   //===== Digital Pins =====//
-
-  byte bid, s;
-  byte bitvalue;
-
-  // Shift out all station bit values
-  // from the highest bit to the lowest
-  for(bid=0;bid<=MAX_EXT_BOARDS;bid++) {
-    bitvalue = 0;
-    if (status.enabled && (!status.rain_delayed) && !(options[OPTION_USE_RAINSENSOR].value && status.rain_sensed))
-      bitvalue = station_bits[MAX_EXT_BOARDS-bid];
+  // Only the master board has pins: station_pins[s] follows
+  // bit 7-s of its station bits
+  byte diff, g, s, b, on, off, oldSREG;
+  diff = bits[0] ^ output_bits[0];
+
+  // one read-modify-write per port, for the pins that changed
+  for(g=0;g<nports;g++) {
+    on = off = 0;
     for(s=0;s<8;s++) {
-      digitalWrite(station_pins[s], (bitvalue & ((byte)1<<(7-s))) ? HIGH : LOW );         
+      b = (byte)1<<(7-s);
+      if (pin_port[s] != g || !(diff & b))  continue;
+      if (bits[0] & b)  on |= pin_mask[s];
+      else  off |= pin_mask[s];
     }
+    if ((on|off) == 0)  continue;
+    oldSREG = SREG;
+    cli();
+    *out_port[g] = (*out_port[g] & ~off) | on;
+    SREG = oldSREG;
   }
-}		
+#endif
+  memcpy(output_bits, bits, sizeof(bits));
+}
+
+// Shift out the bits of all boards, the last board first, and latch
+// them onto the register outputs together. The ethernet controller's
+// traffic also clocks the registers, but it never reaches the outputs
+// as they only change on the latch.
+void OpenSprinkler::shift_out(const byte bits[]) {
+  byte bid;
+  for(bid=0;bid<=MAX_EXT_BOARDS;bid++)
+    SPI.transfer(bits[MAX_EXT_BOARDS-bid]);
+  digitalWrite(PIN_SR_LATCH, HIGH);
+  digitalWrite(PIN_SR_LATCH, LOW);
+}
+
+// Set up the outputs with all stations off
+void OpenSprinkler::outputs_setup() {
+  memset(output_bits, 0, sizeof(output_bits));
+#ifdef SHIFT_REGISTER_OUTPUT
+  // keep the register outputs disabled until they have been cleared
+  pinMode(PIN_SR_OE, OUTPUT);
+  digitalWrite(PIN_SR_OE, HIGH);
+  pinMode(PIN_SR_LATCH, OUTPUT);
+  digitalWrite(PIN_SR_LATCH, LOW);
+  SPI.begin();
+  shift_out(output_bits);
+  digitalWrite(PIN_SR_OE, LOW);
+#else
+  // look up the port and bit of each station pin, and drive it low
+  byte s, g;
+  volatile uint8_t *reg;
+  nports = 0;
+  for(s=0;s<8;s++) {
+    pinMode(station_pins[s], OUTPUT);
+    digitalWrite(station_pins[s], LOW);
+    reg = portOutputRegister(digitalPinToPort(station_pins[s]));
+    for(g=0;g<nports && out_port[g]!=reg;g++);
+    if (g == nports)  out_port[nports++] = reg;
+    pin_port[s] = g;
+    pin_mask[s] = digitalPinToBitMask(station_pins[s]);
+  }
+#endif
+}
 
 // =================
 // Options Functions
@@ -397,7 +450,24 @@ void OpenSprinkler::options_setup() {
   // check reset condition: either firmware version has changed, or reset flag is up
   byte curr_ver = eeprom_read_byte((unsigned char*)(ADDR_EEPROM_OPTIONS+OPTION_FW_VERSION));
   if (curr_ver<100) curr_ver = curr_ver*10; // adding a default 0 if version number is the old type
-  if (curr_ver != SVC_FW_VERSION || eeprom_read_byte((unsigned char*)(ADDR_EEPROM_OPTIONS+OPTION_RESET))==0xAA) {
+  byte reset = eeprom_read_byte((unsigned char*)(ADDR_EEPROM_OPTIONS+OPTION_RESET))==0xAA;
+  if (!reset && curr_ver >= SVC_FW_VERSION_KEEP && curr_ver < SVC_FW_VERSION) {
+
+    //======== Upgrade: reset the programs only ========
+    lcd_print_line_clear_pgm(PSTR("Resetting progs"), 0);
+    lcd_print_line_clear_pgm(PSTR("Please Wait..."), 1);
+
+    for(int i=ADDR_EEPROM_USER; i<INT_EEPROM_SIZE; i++) {
+      eeprom_put_byte(i, 0);
+    }
+    options_load();
+    options[OPTION_FW_VERSION].value = SVC_FW_VERSION;
+    options_save(); // the version goes last, so an interrupted upgrade is redone
+
+    delay(500);
+    reboot();
+  }
+  else if (curr_ver != SVC_FW_VERSION || reset) {
 
     //======== Reset EEPROM data ========
     options_save(); // write default option values
@@ -409,20 +479,20 @@ void OpenSprinkler::options_setup() {
 
     int i, sn;
     for(i=ADDR_EEPROM_STN_NAMES; i<INT_EEPROM_SIZE; i++) {
-      eeprom_write_byte((unsigned char *) i, 0);      
+      eeprom_put_byte(i, 0);      
     }
 
     // reset station names
     for(i=ADDR_EEPROM_STN_NAMES, sn=1; i<ADDR_EEPROM_RUNONCE; i+=STATION_NAME_SIZE, sn++) {
-      eeprom_write_byte((unsigned char *)i    ,'S');
-      eeprom_write_byte((unsigned char *)(i+1),'0'+(sn/10));
-      eeprom_write_byte((unsigned char *)(i+2),'0'+(sn%10)); 
+      eeprom_put_byte(i  , 'S');
+      eeprom_put_byte(i+1, '0'+(sn/10));
+      eeprom_put_byte(i+2, '0'+(sn%10)); 
     }
 
     // reset master operation bits
     for(i=ADDR_EEPROM_MAS_OP; i<ADDR_EEPROM_MAS_OP+(MAX_EXT_BOARDS+1); i++) {
       // default master operation bits on
-      eeprom_write_byte((unsigned char *)i, 0xff);
+      eeprom_put_byte(i, 0xff);
     }
     //======== END OF EEPROM RESET CODE ========
 
@@ -492,7 +562,7 @@ void OpenSprinkler::options_setup() {
 // Load options from internal eeprom
 void OpenSprinkler::options_load() {
   for (byte i=0; i<NUM_OPTIONS; i++) {
-    options[i].value = eeprom_read_byte((unsigned char *)(ADDR_EEPROM_OPTIONS + i));
+    options[i].value = eeprom_read_byte((unsigned char *)(uintptr_t)(ADDR_EEPROM_OPTIONS + i));
   }
   nboards = options[OPTION_EXT_BOARDS].value+1;
   nstations = nboards * 8;
@@ -502,7 +572,7 @@ void OpenSprinkler::options_load() {
 void OpenSprinkler::options_save() {
   // save options in reverse order so version number is saved the last
   for (int i=NUM_OPTIONS-1; i>=0; i--) {
-    eeprom_write_byte((unsigned char *) (ADDR_EEPROM_OPTIONS + i), options[i].value);
+    eeprom_put_byte(ADDR_EEPROM_OPTIONS + i, options[i].value);
   }
   nboards = options[OPTION_EXT_BOARDS].value+1;
   nstations = nboards * 8;
@@ -542,13 +612,74 @@ void OpenSprinkler::raindelay_stop() {
 
 void OpenSprinkler::rainsensor_status() {
   // options[OPTION_RS_TYPE]: 0 if normally closed, 1 if normally open
-  status.rain_sensed = (digitalRead(PIN_RAINSENSOR) == options[OPTION_RAINSENSOR_TYPE].value ? 0 : 1);
+  status.rain_sensed = (input_rain == options[OPTION_RAINSENSOR_TYPE].value ? 0 : 1);
 }
 
 // =============
 // LCD Functions
 // =============
 
+void LcdShadow::begin(byte cols, byte rows) {
+  hw->begin(cols, rows);
+  // the lcd starts out blank
+  memset(shown, ' ', sizeof(shown));
+  hw_row = 0xFF;
+  blinking = false;
+  clear();
+}
+
+void LcdShadow::clear() {
+  memset(cells, ' ', sizeof(cells));
+  col = row = 0;
+}
+
+void LcdShadow::setCursor(byte c, byte r) {
+  col = c;
+  row = r;
+}
+
+// writes past the end of a line are not shown, as on the lcd
+WRITE_RESULT LcdShadow::write(uint8_t c) {
+  if (row < LCD_ROWS && col < LCD_COLS)  cells[row][col] = c;
+  col++;
+  WRITE_RETURN
+}
+
+void LcdShadow::blink() {
+  blinking = true;
+  hw->blink();
+}
+
+void LcdShadow::noBlink() {
+  blinking = false;
+  hw->noBlink();
+}
+
+// defining a character moves the lcd address away from the display
+void LcdShadow::createChar(byte n, byte data[]) {
+  hw->createChar(n, data);
+  hw_row = 0xFF;
+}
+
+void LcdShadow::flush() {
+  byte r, c;
+  for (r=0; r<LCD_ROWS; r++) {
+    for (c=0; c<LCD_COLS; c++) {
+      if (cells[r][c] == shown[r][c])  continue;
+      if (r != hw_row || c != hw_col)  hw->setCursor(c, r);
+      hw->write(cells[r][c]);
+      shown[r][c] = cells[r][c];
+      hw_row = r;
+      hw_col = c+1;
+    }
+  }
+  if (blinking && (row != hw_row || col != hw_col)) {
+    hw->setCursor(col, row);
+    hw_row = row;
+    hw_col = col;
+  }
+}
+
 // Print a program memory string
 void OpenSprinkler::lcd_print_pgm(PGM_P PROGMEM str) {
   uint8_t c;
@@ -567,6 +698,7 @@ void OpenSprinkler::lcd_print_line_clear_pgm(PGM_P PROGMEM str, byte line) {
     cnt++;
   }
   for(; (16-cnt) >= 0; cnt ++) lcd_print_pgm(PSTR(" "));  
+  lcd.flush();
 }
 
 void OpenSprinkler::lcd_print_2digit(int v)
@@ -593,6 +725,7 @@ void OpenSprinkler::lcd_print_time(byte line)
   lcd_print_2digit(month(t));
   lcd_print_pgm(PSTR("-"));
   lcd_print_2digit(day(t));
+  lcd.flush();
 }
 
 // Print free memory
@@ -606,6 +739,7 @@ void OpenSprinkler::lcd_print_memory(byte line)
   
   lcd.setCursor(15, line);
   lcd.write(status.network_fails>0?1:0); 
+  lcd.flush();
 }
 
 // print ip address and port
@@ -620,6 +754,7 @@ void OpenSprinkler::lcd_print_ip(const byte *ip, int http_port) {
   lcd.setCursor(0, 1);
   lcd_print_pgm(PSTR(":"));
   lcd.print(http_port);
+  lcd.flush();
 }
 
 // Print station bits
@@ -656,6 +791,7 @@ void OpenSprinkler::lcd_print_station(byte line, char c) {
   lcd_print_pgm(PSTR("    "));
   lcd.setCursor(15, 1);
   lcd.write(status.network_fails>0?1:0); 
+  lcd.flush();
 }
 
 // Print an option value
@@ -714,9 +850,104 @@ void OpenSprinkler::lcd_print_option(int i) {
   else if (i==OPTION_MASTER_ON_ADJ || i==OPTION_MASTER_OFF_ADJ ||
     i==OPTION_SELFTEST_TIME || i==OPTION_STATION_DELAY_TIME)
     lcd_print_pgm(PSTR(" sec"));
+  lcd.flush();
 }
 
 
+// ===============
+// Input Functions
+// ===============
+
+// called from the interrupt only; the event is dropped if the ring is full
+static void input_push(byte ev) {
+  byte h = input_head;
+  if ((byte)(h - input_tail) == INPUT_QUEUE_SIZE)  return;
+  input_queue[h & (INPUT_QUEUE_SIZE-1)] = ev;
+  input_head = h + 1;   // publish the event only once it is in place
+}
+
+byte OpenSprinkler::input_pop() {
+  byte t = input_tail;
+  if (t == input_head)  return INPUT_NONE;
+  byte ev = input_queue[t & (INPUT_QUEUE_SIZE-1)];
+  input_tail = t + 1;
+  return ev;
+}
+
+void OpenSprinkler::input_flush() {
+  input_tail = input_head;
+}
+
+void OpenSprinkler::input_setup() {
+  rain_in = portInputRegister(digitalPinToPort(PIN_RAINSENSOR));
+  rain_mask = digitalPinToBitMask(PIN_RAINSENSOR);
+
+  // start out with the inputs as they are now, so the startup ui sees a
+  // button held at power up. This also leaves the ADC set to the button
+  // input, which is the only analog input in use
+  input_key = button_decode(analogRead(BUTTON_ADC_PIN));
+  input_rain = (*rain_in & rain_mask) ? 1 : 0;
+
+  // sample on Timer0 compare match A: Timer0 already runs at ~1kHz for
+  // millis(), and a match halfway through its count keeps clear of the
+  // overflow interrupt
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+}
+
+// Each sample picks up the ADC conversion started by the one before, so
+// the interrupt never waits for the ADC. A new button or rain sensor
+// value is only taken once it has lasted INPUT_DEBOUNCE samples.
+void OpenSprinkler::input_sample() {
+  static byte ticks = 0;
+  static byte key_new, key_count;   // button being debounced, and for how many samples
+  static byte rain_count;
+  static unsigned int key_held;     // samples the current button has been down for
+
+  if (++ticks < INPUT_SAMPLE_TICKS)  return;
+  ticks = 0;
+
+  byte key = input_key;
+  if (!(ADCSRA & _BV(ADSC))) {
+    key = button_decode(ADC);
+    ADCSRA |= _BV(ADSC);
+  }
+
+  if (key == input_key) {
+    key_count = 0;
+    if (key != BUTTON_NONE && key_held < INPUT_HOLD_SAMPLES) {
+      if (++key_held == INPUT_HOLD_SAMPLES)  input_push(key | BUTTON_FLAG_HOLD);
+    }
+  } else {
+    if (key != key_new) {
+      key_new = key;
+      key_count = 0;
+    }
+    if (++key_count >= INPUT_DEBOUNCE) {
+      if (input_key != BUTTON_NONE)
+        input_push(input_key | BUTTON_FLAG_UP | (key_held >= INPUT_HOLD_SAMPLES ? BUTTON_FLAG_HOLD : 0));
+      if (key != BUTTON_NONE)
+        input_push(key | BUTTON_FLAG_DOWN);
+      input_key = key;
+      key_held = 0;
+      key_count = 0;
+    }
+  }
+
+  byte rain = (*rain_in & rain_mask) ? 1 : 0;
+  if (rain == input_rain) {
+    rain_count = 0;
+  } else if (++rain_count >= INPUT_DEBOUNCE) {
+    input_push(INPUT_RAIN | (rain ? BUTTON_FLAG_UP : BUTTON_FLAG_DOWN));
+    input_rain = rain;
+    rain_count = 0;
+  }
+}
+
+ISR(TIMER0_COMPA_vect) {
+  OpenSprinkler::input_sample();
+}
+
 // ================
 // Button Functions
 // ================
@@ -808,29 +1039,8 @@ byte OpenSprinkler::button_read(byte waitmode)
   delay(BUTTON_DELAY_MS);
 
   curr = button_sample();
-
-  // Button 1 = Increase  = Up and Right
-  // Button 2 = Decrease = Down and Left 
-  // Button 3 = Select = Select
-  switch (curr) {
-  case BUTTON_UP:
-  case BUTTON_RIGHT:
-    curr = button_read_busy(BUTTON_ADC_PIN, waitmode, BUTTON_1, is_holding);
-    ;
-    break;
-
-  case BUTTON_DOWN:
-  case BUTTON_LEFT:
-    curr = button_read_busy(BUTTON_ADC_PIN, waitmode, BUTTON_2, is_holding);
-    break;
-
-  case BUTTON_SELECT:
-    curr = button_read_busy(BUTTON_ADC_PIN, waitmode, BUTTON_3, is_holding);
-    break;
-
-  default:
-    curr = BUTTON_NONE;
-  }
+  if (curr != BUTTON_NONE)
+    curr = button_read_busy(BUTTON_ADC_PIN, waitmode, curr, is_holding);
 
   /* set flags in return value */
   byte ret = curr;
@@ -845,35 +1055,38 @@ byte OpenSprinkler::button_read(byte waitmode)
 
 byte OpenSprinkler::button_sample()
 {
-  unsigned int buttonVoltage;
-
-  //read the button ADC pin voltage
-  buttonVoltage = analogRead( BUTTON_ADC_PIN );
+  return input_key;
+}
 
+// Button 1 = Increase  = Up and Right
+// Button 2 = Decrease = Down and Left 
+// Button 3 = Select = Select
+byte OpenSprinkler::button_decode(unsigned int buttonVoltage)
+{
   //sense if the voltage falls within valid voltage windows
   if( buttonVoltage < ( RIGHT_10BIT_ADC + BUTTONHYSTERESIS ) )
   {
-    return BUTTON_RIGHT;
+    return BUTTON_1;
   }
   else if(   buttonVoltage >= ( UP_10BIT_ADC - BUTTONHYSTERESIS )
     && buttonVoltage <= ( UP_10BIT_ADC + BUTTONHYSTERESIS ) )
   {
-    return BUTTON_UP;
+    return BUTTON_1;
   }
   else if(   buttonVoltage >= ( DOWN_10BIT_ADC - BUTTONHYSTERESIS )
     && buttonVoltage <= ( DOWN_10BIT_ADC + BUTTONHYSTERESIS ) )
   {
-    return BUTTON_DOWN;
+    return BUTTON_2;
   }
   else if(   buttonVoltage >= ( LEFT_10BIT_ADC - BUTTONHYSTERESIS )
     && buttonVoltage <= ( LEFT_10BIT_ADC + BUTTONHYSTERESIS ) )
   {
-    return BUTTON_LEFT;
+    return BUTTON_2;
   }
   else if(   buttonVoltage >= ( SELECT_10BIT_ADC - BUTTONHYSTERESIS )
     && buttonVoltage <= ( SELECT_10BIT_ADC + BUTTONHYSTERESIS ) )
   {
-    return BUTTON_SELECT;
+    return BUTTON_3;
   }
   else 
     return BUTTON_NONE;
@@ -934,19 +1147,127 @@ void OpenSprinkler::ui_set_options(int oid)
 // ==================
 // String Functions
 // ==================
-void OpenSprinkler::eeprom_string_set(int start_addr, char* buf) {
-  byte i=0;
-  for (; (*buf)!=0; buf++, i++) {
-    eeprom_write_byte((unsigned char*)(start_addr+i), *(buf));
+void OpenSprinkler::eeprom_string_set(int start_addr, const char* buf) {
+  eeprom_put(start_addr, buf, strlen(buf)+1);
+}
+
+// ==================
+// EEPROM Functions
+// ==================
+// region an EEPROM address belongs to
+byte OpenSprinkler::eeprom_region(unsigned int addr) {
+  if (addr < ADDR_EEPROM_PASSWORD)   return EEPROM_REGION_OPTIONS;
+  if (addr < ADDR_EEPROM_LOCATION)   return EEPROM_REGION_PASSWORD;
+  if (addr < ADDR_EEPROM_STN_NAMES)  return EEPROM_REGION_LOCATION;
+  if (addr < ADDR_EEPROM_RUNONCE)    return EEPROM_REGION_STN_NAMES;
+  if (addr < ADDR_EEPROM_MAS_OP)     return EEPROM_REGION_RUNONCE;
+  if (addr < ADDR_EEPROM_USER)       return EEPROM_REGION_MAS_OP;
+  if (addr < ADDR_EEPROM_LOG)        return EEPROM_REGION_PROGRAMS;
+  return EEPROM_REGION_LOG;
+}
+
+// write a block, skipping the bytes that are unchanged
+void OpenSprinkler::eeprom_put(unsigned int addr, const void *src, unsigned int len) {
+  const byte *p = (const byte *)src;
+  EepromStats *st = &eeprom_stats[eeprom_region(addr)];
+  unsigned long t = micros();
+  boolean written = false;
+  for (; len>0; len--, addr++, p++) {
+    if (eeprom_read_byte((unsigned char *)(uintptr_t)addr) == *p) {
+      st->skipped++;
+      continue;
+    }
+    eeprom_write_byte((unsigned char *)(uintptr_t)addr, *p);
+    st->writes++;
+    written = true;
+  }
+  if (written) {
+    eeprom_busy_wait();
+    st->stall_us += micros() - t;
+  }
+}
+
+void OpenSprinkler::eeprom_put_byte(unsigned int addr, byte v) {
+  eeprom_put(addr, &v, 1);
+}
+
+// ==================
+// Loop Probes
+// ==================
+void OpenSprinkler::probe_record(byte stage, unsigned long us) {
+  ProbeStats *p = &probes[stage];
+  byte b = 0;
+  if (p->count == 0 || us < p->min_us)  p->min_us = us;
+  if (us > p->max_us)  p->max_us = us;
+  p->count++;
+  if (p->total_us + us < p->total_us || p->total_n == 0xFFFF) {
+    p->total_us >>= 1;
+    p->total_n >>= 1;
   }
-  eeprom_write_byte((unsigned char*)(start_addr+i), 0);  
+  p->total_us += us;
+  p->total_n++;
+  // bucket 0 holds times below 16us, bucket b times from 2^(b+3)us
+  for (unsigned long v = us >> 4; v && b < PROBE_BUCKETS-1; v >>= 1)  b++;
+  if (p->hist[b] == 0xFF) {
+    for (byte i = 0; i < PROBE_BUCKETS; i++)  p->hist[i] >>= 1;
+  }
+  p->hist[b]++;
+}
+
+unsigned long OpenSprinkler::probe_lap(byte stage, unsigned long t) {
+  unsigned long t1 = micros();
+  probe_record(stage, t1 - t);
+  return t1;
+}
+
+void OpenSprinkler::probes_reset() {
+  memset(probes, 0, sizeof(probes));
+}
+
+// ==================
+// Memory Functions
+// ==================
+// linker symbols of the RAM sections
+extern uint8_t __data_start, __data_end, __bss_start, __bss_end, __heap_start, __stack;
+extern char *__brkval;  // top of the heap, 0 until malloc is first called
+
+// Paint the RAM above the globals with STACK_CANARY before main() runs.
+// It runs from .init3, after the stack pointer and zero register are
+// set up and before any call, so it must not use the stack itself.
+void stack_paint(void) __attribute__ ((naked, used, section(".init3")));
+void stack_paint(void) {
+  uint8_t *p = &__heap_start;
+  while (p <= &__stack)  *p++ = STACK_CANARY;
+}
+
+static uint8_t *heap_end() {
+  return __brkval ? (uint8_t *)__brkval : &__heap_start;
+}
+
+// the lowest byte not holding the paint any more is the deepest the stack has reached
+void OpenSprinkler::stack_scan() {
+  uint8_t *p = heap_end();
+  while (p <= &__stack && *p == STACK_CANARY)  p++;
+  unsigned int used = &__stack - p + 1;
+  if (used > stack_max)  stack_max = used;
+}
+
+void OpenSprinkler::ram_map(RamMap *m) {
+  stack_scan();
+  m->data = &__data_end - &__data_start;
+  m->bss = &__bss_end - &__bss_start;
+  m->heap = heap_end() - &__heap_start;
+  m->stack = &__stack - (uint8_t *)SP;
+  m->stack_max = stack_max;
+  m->free = (uint8_t *)SP - heap_end();
+  m->margin = (&__stack + 1 - stack_max) - heap_end();
 }
 
 void OpenSprinkler::eeprom_string_get(int start_addr, char *buf) {
   byte c;
   byte i = 0;
   do {
-    c = eeprom_read_byte((unsigned char*)(start_addr+i));
+    c = eeprom_read_byte((unsigned char*)(uintptr_t)(start_addr+i));
     //if (c==' ') c='+';
     *(buf++) = c;
     i ++;
@@ -959,7 +1280,7 @@ byte OpenSprinkler::password_verify(char *pw) {
   byte i = 0;
   byte c1, c2;
   while(1) {
-    c1 = eeprom_read_byte((unsigned char*)(ADDR_EEPROM_PASSWORD+i));
+    c1 = eeprom_read_byte((unsigned char*)(uintptr_t)(ADDR_EEPROM_PASSWORD+i));
     c2 = *pw;
     if (c1==0 || c2==0)
       break;
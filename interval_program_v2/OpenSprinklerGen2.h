@@ -38,6 +38,36 @@ struct OptionStruct{
   byte flag;  // flag
 };
 
+// EEPROM write counters of one region
+struct EepromStats {
+  unsigned long writes;   // bytes written
+  unsigned long skipped;  // bytes not written because they were unchanged
+  unsigned long stall_us; // time spent waiting for writes to finish
+};
+
+// timing of one main loop stage
+// (the sum and the histogram halve their counts to stay in range, so
+// older times weigh less in the mean and the histogram gives shares)
+struct ProbeStats {
+  unsigned long count;
+  unsigned long min_us;
+  unsigned long max_us;
+  unsigned long total_us;      // sum of total_n times
+  unsigned int total_n;
+  byte hist[PROBE_BUCKETS];    // log2 histogram
+};
+
+// RAM use, in bytes
+struct RamMap {
+  unsigned int data;      // initialized globals
+  unsigned int bss;       // zeroed globals
+  unsigned int heap;      // malloc'ed
+  unsigned int stack;     // stack in use now
+  unsigned int stack_max; // deepest stack use since boot
+  unsigned int free;      // between heap and stack now
+  unsigned int margin;    // between heap and the deepest stack use
+};
+
 struct StatusBits {
 byte enabled:        1;     // operation enable (when set, controller operation is enabled)
 byte rain_delayed:   1;     // rain delay bit (when set, rain delay is applied)
@@ -50,11 +80,37 @@ byte display_board:  4;     // the board that is being displayed onto the lcd
 byte network_fails:  4;     // number of network fails
 }; 
 
+// Shadow of the lcd contents. Drawing goes into the shadow, and flush()
+// sends only the cells that differ from what the lcd shows, moving the
+// lcd cursor only when the next changed cell is not where it already is.
+class LcdShadow : public Print {
+public:
+  LcdShadow(LiquidCrystal *dev) : hw(dev) {}
+  void begin(byte cols, byte rows);
+  void clear();
+  void setCursor(byte col, byte row);
+  void blink();
+  void noBlink();
+  void createChar(byte n, byte data[]);
+  void flush();
+  virtual WRITE_RESULT write(uint8_t c);
+  using Print::write;
+
+private:
+  LiquidCrystal *hw;
+  byte cells[LCD_ROWS][LCD_COLS]; // contents as drawn
+  byte shown[LCD_ROWS][LCD_COLS]; // contents on the lcd
+  byte col, row;                  // drawing position
+  byte hw_col, hw_row;            // lcd cursor position, hw_row is 0xFF if unknown
+  boolean blinking;               // cursor shown, so it must end up at the drawing position
+};
+
 class OpenSprinkler {
 public:
 
   // ====== Data Members ======
-  static LiquidCrystal lcd;
+  static LiquidCrystal lcd_hw;
+  static LcdShadow lcd;     // all drawing goes through the shadow
   static StatusBits status;
   static byte nboards, nstations;
   static OptionStruct options[];  // option values, max, name, and flag
@@ -64,6 +120,9 @@ public:
   // first byte-> master controller, second byte-> ext. board 1, and so on
   static byte masop_bits[];   // station master operation bits. each byte corresponds to a board (8 stations)
   static unsigned long raindelay_stop_time;   // time (in seconds) when raindelay is stopped
+  static EepromStats eeprom_stats[];  // write counters of each EEPROM region, since boot
+  static ProbeStats probes[];         // timing of each main loop stage, since boot or reset
+  static unsigned int stack_max;      // deepest stack use found so far (bytes)
 
   //===== Digital Outputs =====// 
   static int station_pins[];
@@ -97,10 +156,30 @@ public:
   static void clear_all_station_bits(); // clear all station bits
   static void apply_all_station_bits(); // apply all station bits (activate/deactive values)
 
+  // -- EEPROM access --
+  // All writes go through these: bytes that already hold the value are
+  // skipped, and each call waits for its writes to finish so that the
+  // time is counted against the region written
+  static void eeprom_put(unsigned int addr, const void *src, unsigned int len);
+  static void eeprom_put_byte(unsigned int addr, byte v);
+  static byte eeprom_region(unsigned int addr);
+
+  // -- Loop probes --
+  // record the time of a stage that started at micros() t,
+  // and return the current micros() for the next stage
+  static unsigned long probe_lap(byte stage, unsigned long t);
+  static void probe_record(byte stage, unsigned long us);
+  static void probes_reset();
+
+  // -- Memory --
+  static void stack_scan();           // update stack_max from the stack paint
+  static void ram_map(RamMap *m);
+  static unsigned int ram_size();     // RAM taken by this class
+
   // -- String functions --
   //static void password_set(char *pw);     // save password to eeprom
   static byte password_verify(char *pw);  // verify password
-  static void eeprom_string_set(int start_addr, char* buf);
+  static void eeprom_string_set(int start_addr, const char* buf);
   static void eeprom_string_get(int start_addr, char* buf);
 
   // -- LCD functions --
@@ -117,6 +196,16 @@ public:
   // return values are 'OR'ed with flags
   // check defines.h for details
 
+  // -- Input events --
+  // The buttons and the rain sensor are sampled and debounced by a timer
+  // interrupt, which queues their changes for the main loop: a button
+  // gives a DOWN event, a HOLD event once it has been down BUTTON_HOLD_MS,
+  // and an UP event (with the HOLD flag if it was held) on release
+  static void input_setup();
+  static void input_sample();   // called from the timer interrupt only
+  static byte input_pop();      // next queued event, INPUT_NONE if none
+  static void input_flush();    // drop all queued events
+
   // -- UI functions --
   static void ui_set_options(int oid);    // ui for setting options (oid-> starting option index)
 
@@ -126,8 +215,23 @@ private:
   static byte button_read_busy(byte pin_butt, byte waitmode, byte butt, byte is_holding);
 
   // ===== Added for Freetronics LCD Shield =====
-  static byte button_sample();          // new function to sample analog button input
+  static byte button_sample();          // debounced button, as last sampled by the interrupt
+  static byte button_decode(unsigned int adc); // button that an ADC reading of the button input stands for
   // ===== Added for Freetronics LCD Shield =====
+
+  // -- Station outputs --
+  // Outputs are only written when the bits to apply have changed. With
+  // SHIFT_REGISTER_OUTPUT all boards are shifted out over SPI and latched
+  // at once; otherwise the station pins are written directly to their
+  // port registers, and only those that change: each pin's port (index
+  // into out_port) and bit are looked up once at startup
+  static void outputs_setup();
+  static void shift_out(const byte bits[]);
+  static byte output_bits[];            // station bits last applied to the outputs
+  static byte nports;                   // number of ports the station pins are on
+  static volatile uint8_t *out_port[];  // output register of each of those ports
+  static byte pin_port[];               // port index of each station pin
+  static byte pin_mask[];               // bit of each station pin in its port
 };
 
 #endif
@@ -9,9 +9,12 @@
 #define _Defines_h
 
 // Firmware version
-#define SVC_FW_VERSION  200 // firmware version (e.g. 2.0.0 etc)
+#define SVC_FW_VERSION  202 // firmware version (e.g. 2.0.0 etc)
 // if this number is different from stored in EEPROM,
 // an EEPROM reset will be automatically triggered
+#define SVC_FW_VERSION_KEEP  200 // upgrading from this version or later only
+// resets the programs (from ADDR_EEPROM_USER on), keeping the options,
+// password, location and station names, which have not moved since
 
 #define MAX_EXT_BOARDS    5 // maximum number of ext. boards (each expands 8 stations)
 // total number of stations: (1+MAX_EXT_BOARDS) * 8
@@ -32,6 +35,56 @@
 #define ADDR_EEPROM_USER        (ADDR_EEPROM_MAS_OP+(MAX_EXT_BOARDS+1))
 // address where program schedule data is stored
 
+// address where the run log is stored, in the eeprom above INT_EEPROM_SIZE
+// that larger chips have (2K more on the ATmega2560)
+#define ADDR_EEPROM_LOG         INT_EEPROM_SIZE
+#if defined(E2END) && (E2END+1 > INT_EEPROM_SIZE)
+#define LOG_EEPROM_SIZE         (E2END+1-INT_EEPROM_SIZE)
+#else
+#define LOG_EEPROM_SIZE         0       // no room, run log disabled
+#endif
+
+// Uncomment to keep programs in a file on the SD card (PIN_SD_CS)
+// instead of the internal EEPROM, for many more programs
+//#define SD_PROGRAM_STORE
+#define SD_PROGRAM_FILE         "PROGRAMS.DAT"
+#define SD_MAX_PROGRAMS         98      // stations record program index pid+1, and
+                                        // 99 (manual mode) and 254 (run-once) are taken
+#if SD_MAX_PROGRAMS > 98
+#error "SD_MAX_PROGRAMS above 98 collides with the manual mode program index"
+#endif
+
+// EEPROM regions, for the write counters
+typedef enum {
+  EEPROM_REGION_OPTIONS = 0,
+  EEPROM_REGION_PASSWORD,
+  EEPROM_REGION_LOCATION,
+  EEPROM_REGION_STN_NAMES,
+  EEPROM_REGION_RUNONCE,
+  EEPROM_REGION_MAS_OP,
+  EEPROM_REGION_PROGRAMS,
+  EEPROM_REGION_LOG,
+  NUM_EEPROM_REGIONS
+}
+OS_EEPROM_REGION_t;
+
+// Stages of the main loop, for the timing probes
+typedef enum {
+  PROBE_LOOP = 0,       // the whole loop
+  PROBE_PACKETS,        // ethernet packets and http requests
+  PROBE_BUTTONS,        // button_poll
+  PROBE_SCHEDULE,       // rain checks and program matching
+  PROBE_RUNNER,         // station start/stop events and master station
+  PROBE_OUTPUTS,        // apply_all_station_bits
+  PROBE_LCD,            // time and station display
+  PROBE_CHECK_NETWORK,  // check_network
+  PROBE_NTP,            // perform_ntp_sync
+  NUM_PROBES
+}
+OS_PROBE_t;
+
+#define PROBE_BUCKETS 16  // histogram buckets: <16us, then doubling up to >=262ms
+
 #define DEFAULT_PASSWORD        "spectrum"
 #define DEFAULT_LOCATION        "podgorica" 
 // zip code, city name or any google supported location strings
@@ -97,10 +150,13 @@ OS_OPTION_t;
 #define PIN_RF_DATA       28    // RF data pin 
 
 //===== Shift Register =====//
-//#define PIN_SR_LATCH       3    // shift register latch pin
-//#define PIN_SR_DATA       21    // shift register data pin
-//#define PIN_SR_CLOCK      22    // shift register clock pin
-//#define PIN_SR_OE          1    // shift register output enable pin
+// Uncomment to drive the stations through a chain of 74HC595 shift
+// registers, one per board, instead of the station pins. Data and clock
+// come from the hardware SPI bus shared with the ethernet controller
+// (MOSI 51, SCK 52 on the Mega)
+//#define SHIFT_REGISTER_OUTPUT
+#define PIN_SR_LATCH       3    // shift register latch pin
+#define PIN_SR_OE          2    // shift register output enable pin (active low)
 
 //===== Digital Outputs =====//  
 #define PIN_STN_S1        46      // use these when switching relays
@@ -122,8 +178,8 @@ OS_OPTION_t;
 #define PIN_LCD_D7         7    // LCD d7 pin - default = 23
 #define PIN_LCD_BACKLIGHT  23    // LCD backlight pin - default = 12
 #define PIN_LCD_CONTRAST  36    // LCD contrast pin - default = 13
-#define PIN_ETHER_CS      4    // Ethernet controller chip select pin - default = 4
-#define PIN_SD_CS         10    // SD card chip select pin - default = 0
+#define PIN_ETHER_CS      10    // Ethernet controller chip select pin, fixed at D10 on the shield
+#define PIN_SD_CS         4    // SD card chip select pin, D4 on the Ethernet shield
 #define PIN_RAINSENSOR    39    // rain sensor is connected to pin D3 - default = 11
 #define BUTTON_ADC_PIN    A0    // A0 is the button ADC input
 
@@ -172,6 +228,17 @@ OS_OPTION_t;
 #define BUTTON_WAIT_RELEASE    1  // wait until button is release
 #define BUTTON_WAIT_HOLD       2  // wait until button hold time expires
 
+// input event values: a button, or INPUT_RAIN, 'OR'ed with a flag. Rain
+// sensor events carry BUTTON_FLAG_UP if the pin went high, DOWN if low
+#define INPUT_NONE          0x00  // no event queued
+#define INPUT_RAIN          0x08  // rain sensor pin changed
+
+// input sampling values
+#define INPUT_SAMPLE_TICKS     4  // sample the inputs every 4 Timer0 interrupts (~4ms)
+#define INPUT_DEBOUNCE         3  // samples a new input value must last to be taken
+#define INPUT_HOLD_SAMPLES     (BUTTON_HOLD_MS/INPUT_SAMPLE_TICKS)
+#define INPUT_QUEUE_SIZE       8  // input event ring size, must be a power of 2
+
 // ====== Timing Defines ======
 #define DISPLAY_MSG_MS      2000  // message display time (milliseconds)
 
@@ -186,7 +253,11 @@ OS_OPTION_t;
 #define REBOOT_MIN           00     // min  to perform daily reboot
 #define REBOOT_SEC           00     // sec  to perform daily reboot
 
+#define LCD_COLS     16             // lcd size
+#define LCD_ROWS     2
 #define SHOW_MEMORY  true           // flag for testing - displays free memory instead of station info
+#define STACK_CANARY         0xC5   // paint of the free RAM, to find the deepest stack use
+#define STACK_SCAN_INTERVAL  60     // how often (in seconds) the stack paint is checked
 
 #define STATIC_IP_1  192            // Default IP to be stored in eeprom on first run
 #define STATIC_IP_2  168
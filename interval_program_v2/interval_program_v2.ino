@@ -20,7 +20,6 @@
 #include <SPI.h>
 #include <Ethernet.h>
 #include <EthernetUdp.h>
-#include <ICMPPing.h>
 // ===== Added for W5100 =====
 
 #include <limits.h>
@@ -41,6 +40,14 @@
 #define RTC_SYNC_INTERVAL       60      // Interval for checking network connection (in seconds) - 1 minute default
 #define CHECK_NETWORK_INTERVAL  60      // Ping test time out (in milliseconds)- 1 minute default
 #define PING_TIMEOUT            200     // 0.2 second default
+#define PING_TRIES              2       // echo requests per check before it counts as failed
+#define NTP_RESPONSE_TIMEOUT    1000    // how long to wait for an NTP answer (in milliseconds)
+#define NTP_MAX_TRIES           5       // requests per sync before giving up until the next interval
+#define NTP_RETRY_DELAY         2       // seconds before the first retry, doubled after each failure
+
+// NTP sync states
+#define NTP_IDLE                0
+#define NTP_WAITING             1       // request sent, answer not in yet
 
 // ====== Ethernet defines ======
 byte mymac[] = { 0x00,0x69,0x69,0x2D,0x30,0x00 }; // mac address
@@ -53,8 +60,6 @@ int myport;
 byte EtherCard::buffer[ETHER_BUFFER_SIZE]; // Ethernet packet buffer
 EthernetServer server(STATIC_PORT0);       // Initialize the Ethernet server library
 EthernetUDP udp;                           // A UDP instance to let us send and receive packets over UDP
-SOCKET pingSocket = 0;                     // Ping socket
-ICMPPing ping(pingSocket);                 // Ping object 
 // ===== Added for W5100 & Auto Reboot =====
 
 char tmp_buffer[TMP_BUFFER_SIZE+1];       // scratch buffer
@@ -67,50 +72,63 @@ ProgramData pd;       // ProgramdData object
 // ====== UI defines ======
 static char ui_anim_chars[3] = {'.', 'o', 'O'};
 
-// poll button press
-void button_poll() {
+static unsigned long ui_msg_until;  // millis() until which a message stays on the lcd
+static byte ui_msg_shown = 0;
+
+// keep a message on the lcd for DISPLAY_MSG_MS
+void ui_msg_hold() {
+  ui_msg_until = millis() + DISPLAY_MSG_MS;
+  ui_msg_shown = 1;
+}
 
-  // read button, if something is pressed, wait till release
-  byte button = svc.button_read(BUTTON_WAIT_HOLD);
-
-  if (!(button & BUTTON_FLAG_DOWN)) return;  // repond only to button down events
-
-  switch (button & BUTTON_MASK) {
-  case BUTTON_1:
-    if (button & BUTTON_FLAG_HOLD) {
-      // hold button 1 -> start operation
-      svc.enable();
-    } 
-    else {
-      // click button 1 -> display ip address and port number
-      svc.lcd_print_ip(ether.myip, ether.hisport);
-      delay(DISPLAY_MSG_MS);
+// process the button and rain sensor events queued by the input interrupt
+void button_poll() {
+  byte ev;
+  while ((ev = svc.input_pop()) != INPUT_NONE) {
+    if ((ev & BUTTON_MASK) == INPUT_RAIN) {
+      svc.rainsensor_status();
+      continue;
     }
-    break;
-
-  case BUTTON_2:
-    if (button & BUTTON_FLAG_HOLD) {
-      // hold button 2 -> disable operation
-      svc.disable();
-    } 
-    else {
-      // click button 2 -> display gateway ip address and port number
-      svc.lcd_print_ip(ether.gwip, 0);
-      delay(DISPLAY_MSG_MS);
+    // a button is acted on once its hold time is up, or at its
+    // release if it was let go before then
+    if (ev & BUTTON_FLAG_HOLD) {
+      switch (ev & BUTTON_MASK) {
+      case BUTTON_1:
+        // hold button 1 -> start operation
+        if (!(ev & BUTTON_FLAG_UP))  svc.enable();
+        break;
+
+      case BUTTON_2:
+        // hold button 2 -> disable operation
+        if (!(ev & BUTTON_FLAG_UP))  svc.disable();
+        break;
+
+      case BUTTON_3:
+        // hold button 3 -> reboot, once it is released
+        if (ev & BUTTON_FLAG_UP)  svc.reboot();
+        break;
+      }
     }
-    break;
-
-  case BUTTON_3:
-    if (button & BUTTON_FLAG_HOLD) {
-      // hold button 3 -> reboot
-      svc.button_read(BUTTON_WAIT_RELEASE);
-      svc.reboot();
-    } 
-    else {
-      // click button 3 -> switch board display (cycle through master and all extension boards)
-      svc.status.display_board = (svc.status.display_board + 1) % (svc.nboards);
+    else if (ev & BUTTON_FLAG_UP) {
+      switch (ev & BUTTON_MASK) {
+      case BUTTON_1:
+        // click button 1 -> display ip address and port number
+        svc.lcd_print_ip(ether.myip, ether.hisport);
+        ui_msg_hold();
+        break;
+
+      case BUTTON_2:
+        // click button 2 -> display gateway ip address and port number
+        svc.lcd_print_ip(ether.gwip, 0);
+        ui_msg_hold();
+        break;
+
+      case BUTTON_3:
+        // click button 3 -> switch board display (cycle through master and all extension boards)
+        svc.status.display_board = (svc.status.display_board + 1) % (svc.nboards);
+        break;
+      }
     }
-    break;
   }
 }
 
@@ -145,6 +163,9 @@ void setup() {
   perform_ntp_sync(now());
 
   svc.lcd_print_time(0);  // display time to LCD
+
+  // drop button events left over from the startup ui
+  svc.input_flush();
    
   // ===== Added for Auto Reboot =====
   // wdt_enable(WDTO_4S);  // enabled watchdog timer    
@@ -162,14 +183,18 @@ void loop()
   static unsigned long last_minute = 0;
   static uint16_t pos;
 
-  byte bid, sid, s, pid, seq, bitvalue, mas;
+  byte bid, sid, s, pid, seq, mas;
   ProgramStruct prog;
 
+  // stage timing probes, t is when the current stage started
+  unsigned long loop_start = micros();
+  unsigned long t = loop_start;
+  unsigned long lcd_us;
+
   seq = svc.options[OPTION_SEQUENTIAL].value;
   mas = svc.options[OPTION_MASTER_STATION].value;
 
   // ====== Process Ethernet packets ======
-  int plen=0;
   pos=ether.packetLoop(ether.packetReceive());
   if (pos>0) {  // packet received
     bfill = ether.tcpOffset();
@@ -182,15 +207,22 @@ void loop()
     ether.httpServerReply(bfill.position());   
   }
   // ======================================
+  t = svc.probe_lap(PROBE_PACKETS, t);
 
   button_poll();    // process button press
+  t = svc.probe_lap(PROBE_BUTTONS, t);
 
   // if 1 second has passed
   time_t curr_time = now();      
   if (last_time != curr_time) {
 
     last_time = curr_time;
-    svc.lcd_print_time(0);       // print time
+    // a message put up by a button stays until its time is up
+    if (ui_msg_shown && (long)(millis() - ui_msg_until) >= 0)  ui_msg_shown = 0;
+    if (!ui_msg_shown)
+      svc.lcd_print_time(0);     // print time
+    lcd_us = micros() - t;
+    t += lcd_us;
 
     // ====== Check raindelay status ======
     if (svc.status.rain_delayed) {
@@ -214,29 +246,27 @@ void loop()
       // we only need to check once every minute
       if (curr_minute != last_minute) {
         last_minute = curr_minute;
-        // check through all programs
-        for(pid=0; pid<pd.nprograms; pid++) {
+        // go through the programs that start at this minute
+        while((pid = pd.schedule_next(curr_time)) != SCHEDULE_NONE) {
           pd.read(pid, &prog);
-          if(prog.check_match(curr_time) && prog.duration != 0) {
-            // program match found
-            // process all selected stations
-            for(bid=0; bid<svc.nboards; bid++) {
-              for(s=0;s<8;s++) {
-                sid=bid*8+s;
-                // ignore master station because it's not scheduled independently
-                if (mas == sid+1)  continue;
-                // if the station is current running, skip it
-                if (svc.station_bits[bid]&(1<<s)) continue;
-
-                // if station bits match
-                if(prog.stations[bid]&(1<<s)) {
-                  // initialize schedule data
-                  // store duration temporarily in stop_time variable
-                  // duration is scaled by water level
-                  pd.scheduled_stop_time[sid] = (unsigned long)prog.duration * svc.options[OPTION_WATER_LEVEL].value / 100;
-                  pd.scheduled_program_index[sid] = pid+1;
-                  match_found = true;
-                }
+          // program match found
+          // process all selected stations
+          for(bid=0; bid<svc.nboards; bid++) {
+            for(s=0;s<8;s++) {
+              sid=bid*8+s;
+              // ignore master station because it's not scheduled independently
+              if (mas == sid+1)  continue;
+              // if the station is current running, skip it
+              if (svc.station_bits[bid]&(1<<s)) continue;
+
+              // if station bits match
+              if(prog.stations[bid]&(1<<s)) {
+                // initialize schedule data
+                // store duration temporarily in stop_time variable
+                // duration is scaled by water level
+                pd.scheduled_stop_time[sid] = (unsigned long)prog.duration * svc.options[OPTION_WATER_LEVEL].value / 100;
+                pd.scheduled_program_index[sid] = pid+1;
+                match_found = true;
               }
             }
           }
@@ -248,78 +278,77 @@ void loop()
         }
       }//if_check_current_minute
     } //if_cleared_for_scheduling
+    t = svc.probe_lap(PROBE_SCHEDULE, t);
 
     // ====== Run program data ======
     // Check if a program is running currently
     if (svc.status.program_busy){
-      for(bid=0;bid<svc.nboards; bid++) {
-        bitvalue = svc.station_bits[bid];
-        for(s=0;s<8;s++) {
-          byte sid = bid*8+s;
+      // handle the station start/stop events that are due
+      if (curr_time >= pd.next_event_time()) {
+        while((sid = pd.queue_pop(curr_time)) != QUEUE_NONE) {
+          bid = sid>>3;
+          s = sid&0x07;
 
           // check if the current station is already running
-          if(((bitvalue>>s)&1)) {
-            // if so, check if we should turn it off
-            if (curr_time >= pd.scheduled_stop_time[sid])
-            {
-              svc.set_station_bit(sid, 0);
+          if(svc.station_bits[bid]&(1<<s)) {
+            // if so, its stop time has come
+            svc.set_station_bit(sid, 0);
 
-              // record lastrun log (only for non-master stations)
-              if(mas != sid+1)
+            // record lastrun log (only for non-master stations)
+            if(mas != sid+1)
+            {
+              pd.lastrun.station = sid;
+              pd.lastrun.program = pd.scheduled_program_index[sid];
+              pd.lastrun.duration = curr_time - pd.scheduled_start_time[sid];
+              pd.lastrun.endtime = curr_time;
+              pd.log_append(&pd.lastrun);
+            }      
+
+            // reset program data variables
+            //pd.remaining_time[sid] = 0;
+            pd.scheduled_start_time[sid] = 0;
+            pd.scheduled_stop_time[sid] = 0;
+            pd.scheduled_program_index[sid] = 0;            
+          }
+          else if (curr_time < pd.scheduled_stop_time[sid]) {
+            // if not running, its start time has come
+            svc.set_station_bit(sid, 1);
+            // queue its stop time
+            pd.queue_station(sid);
+
+            // schedule master station here if
+            // 1) master station is defined
+            // 2) the station is non-master and is set to activate master
+            // 3) controller is not running in manual mode AND sequential is true
+            if ((mas>0) && (mas!=sid+1) && (svc.masop_bits[bid]&(1<<s)) && seq && svc.status.manual_mode==0) {
+              byte masid=mas-1;
+              // master will turn on when a station opens,
+              // adjusted by the master on and off time
+              pd.scheduled_start_time[masid] = pd.scheduled_start_time[sid]+svc.options[OPTION_MASTER_ON_ADJ].value;
+              pd.scheduled_stop_time[masid] = pd.scheduled_stop_time[sid]+svc.options[OPTION_MASTER_OFF_ADJ].value-60;
+              pd.scheduled_program_index[masid] = pd.scheduled_program_index[sid];
+              // check if we should turn master on now
+              if (curr_time >= pd.scheduled_start_time[masid] && curr_time < pd.scheduled_stop_time[masid])
               {
-                pd.lastrun.station = sid;
-                pd.lastrun.program = pd.scheduled_program_index[sid];
-                pd.lastrun.duration = curr_time - pd.scheduled_start_time[sid];
-                pd.lastrun.endtime = curr_time;
-              }      
-
-              // reset program data variables
-              //pd.remaining_time[sid] = 0;
-              pd.scheduled_start_time[sid] = 0;
-              pd.scheduled_stop_time[sid] = 0;
-              pd.scheduled_program_index[sid] = 0;            
+                svc.set_station_bit(masid, 1);
+              }
+              pd.queue_station(masid);
             }
           }
           else {
-            // if not running, check if we should turn it on
-            if (curr_time >= pd.scheduled_start_time[sid] && curr_time < pd.scheduled_stop_time[sid]) {
-              svc.set_station_bit(sid, 1);
-
-              // schedule master station here if
-              // 1) master station is defined
-              // 2) the station is non-master and is set to activate master
-              // 3) controller is not running in manual mode AND sequential is true
-              if ((mas>0) && (mas!=sid+1) && (svc.masop_bits[bid]&(1<<s)) && seq && svc.status.manual_mode==0) {
-                byte masid=mas-1;
-                // master will turn on when a station opens,
-                // adjusted by the master on and off time
-                pd.scheduled_start_time[masid] = pd.scheduled_start_time[sid]+svc.options[OPTION_MASTER_ON_ADJ].value;
-                pd.scheduled_stop_time[masid] = pd.scheduled_stop_time[sid]+svc.options[OPTION_MASTER_OFF_ADJ].value-60;
-                pd.scheduled_program_index[masid] = pd.scheduled_program_index[sid];
-                // check if we should turn master on now
-                if (curr_time >= pd.scheduled_start_time[masid] && curr_time < pd.scheduled_stop_time[masid])
-                {
-                  svc.set_station_bit(masid, 1);
-                }
-              }
-            }
+            // the stop time has passed before the station could start
+            pd.scheduled_start_time[sid] = 0;
+            pd.scheduled_stop_time[sid] = 0;
+            pd.scheduled_program_index[sid] = 0;
           }
-        }//end_s
-      }//end_bid
-
-      // activate/deactivate valves
-      svc.apply_all_station_bits();
-
-      boolean program_still_busy = false;
-      for(sid=0;sid<svc.nstations;sid++) {
-        // check if any station has a non-zero and non-infinity stop time
-        if (pd.scheduled_stop_time[sid] > 0 && pd.scheduled_stop_time[sid] < ULONG_MAX) {
-          program_still_busy = true;
-          break;
         }
+
+        // activate/deactivate valves
+        svc.apply_all_station_bits();
       }
-      // if the program is finished, reset program busy bit
-      if (program_still_busy == false) {
+
+      // if no station has a pending event, the program is finished
+      if (pd.nqueued == 0) {
         // turn off all stations
         svc.clear_all_station_bits();
 
@@ -332,37 +361,57 @@ void loop()
     }//if_some_program_is_running
 
     // handle master station for manual or parallel mode
-    if ((mas>0) && svc.status.manual_mode==1 || seq==0) {
+    if ((mas>0) && (svc.status.manual_mode==1 || seq==0)) {
       // in parallel mode or manual mode
       // master will remain on until the end of program
       byte masbit = 0;
-      for(sid=0;sid<svc.nstations;sid++) {
-        bid = sid>>3;
-        s = sid&0x07;
+      for(bid=0;bid<svc.nboards;bid++) {
         // check there is any non-master station that activates master and is currently turned on
-        if ((mas!=sid+1) && (svc.station_bits[bid]&(1<<s)) && (svc.masop_bits[bid]&(1<<s))) {
+        byte bits = svc.station_bits[bid] & svc.masop_bits[bid];
+        if (bid == ((mas-1)>>3))  bits &= ~(1<<((mas-1)&0x07));
+        if (bits) {
           masbit = 1;
           break;
         }
       }
-      svc.set_station_bit(mas-1, masbit);
+      byte masid = mas-1;
+      if (((svc.station_bits[masid>>3]>>(masid&0x07))&1) != masbit) {
+        svc.set_station_bit(masid, masbit);
+        // a pending event of the master is keyed by its station bit
+        pd.queue_station(masid);
+      }
     }    
+    t = svc.probe_lap(PROBE_RUNNER, t);
 
     // activate/deactivate valves
     svc.apply_all_station_bits();
+    t = svc.probe_lap(PROBE_OUTPUTS, t);
 
     // process LCD display
-    if(SHOW_MEMORY)
+    if (ui_msg_shown)
+      ;
+    else if(SHOW_MEMORY)
       svc.lcd_print_memory(1);
     else
       svc.lcd_print_station(1, ui_anim_chars[curr_time%3]);
-
-    // check network connection
-    check_network(curr_time);
-
-    // perform ntp sync
-    perform_ntp_sync(curr_time);
+    unsigned long t1 = micros();
+    svc.probe_record(PROBE_LCD, lcd_us + (t1 - t));
+    t = t1;
+
+    // check how deep the stack has grown (timed with the whole loop only)
+    if (curr_time % STACK_SCAN_INTERVAL == 0) {
+      svc.stack_scan();
+      t = micros();
+    }
   }
+
+  // check network connection and perform ntp sync (checked on every
+  // pass so that answers are picked up as soon as they arrive)
+  check_network(curr_time);
+  t = svc.probe_lap(PROBE_CHECK_NETWORK, t);
+  perform_ntp_sync(curr_time);
+  t = svc.probe_lap(PROBE_NTP, t);
+  svc.probe_record(PROBE_LOOP, t - loop_start);
 }
 
 void manual_station_off(byte sid) {
@@ -370,6 +419,7 @@ void manual_station_off(byte sid) {
 
   // set station stop time (now)
   pd.scheduled_stop_time[sid] = curr_time;  
+  pd.queue_station(sid);
 }
 
 void manual_station_on(byte sid, int ontimer) {
@@ -384,85 +434,112 @@ void manual_station_on(byte sid, int ontimer) {
   }
   // set program index
   pd.scheduled_program_index[sid] = 99;
+  pd.queue_station(sid);
   svc.status.program_busy = 1;
 }
 
+// NTP sync runs as a state machine: a request is sent and the
+// function returns, the answer is collected on a later call.
+// Unanswered requests are retried with an increasing delay.
 void perform_ntp_sync(time_t curr_time) {
   static unsigned long last_sync_time = 0;
+  static unsigned long next_try_time = 0;
+  static unsigned long request_millis;
+  static byte state = NTP_IDLE;
+  static byte tries = 0;
   // do not perform sync if this option is disabled, or if network is not available
-  if (svc.options[OPTION_USE_NTP].value==0 || svc.status.network_fails>0) return;   
-  // sync every 1 hour
-  if (last_sync_time == 0 || (curr_time - last_sync_time > NTP_SYNC_INTERVAL)) {
-    last_sync_time = curr_time;
-    unsigned long t = getNtpTime();   
+  if (svc.options[OPTION_USE_NTP].value==0 || svc.status.network_fails>0 || ether.dhcpBusy()) {
+    if (state == NTP_WAITING)  ether.ntpClose();
+    state = NTP_IDLE;
+    return;
+  }
+
+  if (state == NTP_WAITING) {
+    unsigned long t = ntp_check_response();
     if (t>0) {    
+      ether.ntpClose();
       setTime(t);
       if (svc.status.has_rtc) RTC.set(t); // if rtc exists, update rtc
+      last_sync_time = t;
+      tries = 0;
+      state = NTP_IDLE;
+    }
+    else if (millis() - request_millis > NTP_RESPONSE_TIMEOUT) {
+      // no answer, back off before the next request
+      ether.ntpClose();
+      state = NTP_IDLE;
+      if (++tries < NTP_MAX_TRIES) {
+        next_try_time = curr_time + (NTP_RETRY_DELAY << (tries-1));
+      }
+      else {
+        // give up until the next sync interval
+        tries = 0;
+        last_sync_time = curr_time;
+      }
     }
+    return;
+  }
+
+  if (tries > 0) {
+    if (curr_time < next_try_time)  return;
   }
+  // sync every NTP_SYNC_INTERVAL
+  else if (last_sync_time != 0 && (curr_time - last_sync_time <= NTP_SYNC_INTERVAL))  return;
+
+  ether.ntpRequest(ntpip, ++ntpclientportL);
+  request_millis = millis();
+  state = NTP_WAITING;
 }
 
+// The gateway is pinged without waiting for the reply: the echo request
+// goes out on one call and the reply is looked for on the following ones.
 void check_network(time_t curr_time) {
   static unsigned long last_check_time = 0;
+  static unsigned long ping_millis;
+  static byte tries = 0;    // echo requests sent in the current check
 
   if (last_check_time == 0) {
     last_check_time = curr_time; 
     return;
   }
+  // no point checking while an address is still being obtained
+  if (ether.dhcpBusy())  return;
 
-  // ===== Added for W5100 =====
-  
-/*
-  // check network condition periodically
-  if (curr_time - last_check_time > CHECK_NETWORK_INTERVAL) 
-  {
-    last_check_time = curr_time;
-
-    // ping gateway ip
-    ether.clientIcmpRequest(ether.gwip);
-
-    unsigned long start = millis();
-    boolean failed = true;
-    // wait at most PING_TIMEOUT milliseconds for ping result
-    do {
-      ether.packetLoop(ether.packetReceive());
-      if (ether.packetLoopIcmpCheckReply(ether.gwip)) {
-        failed = false;
-        break;
+  if (tries > 0) {
+    if (ether.packetLoopIcmpCheckReply(ether.gwip)) {
+      tries = 0;
+      svc.status.network_fails=0;
+    }
+    else if (millis() - ping_millis > PING_TIMEOUT) {
+      if (tries < PING_TRIES) {
+        tries++;
+        ether.clientIcmpRequest(ether.gwip);   // keeps the socket it has
+        ping_millis = millis();
+        return;
+      }
+      tries = 0;
+      ether.icmpClose();
+      svc.status.network_fails++;
+      // if failed more than 2 times in a row, reconnect
+      // (this does not wait for the link or a DHCP lease either)
+      if (svc.status.network_fails>2&&svc.options[OPTION_NETFAIL_RECONNECT].value) {
+        svc.start_network(mymac, myport);
       }
-    } 
-    while(millis() - start < PING_TIMEOUT);
-    if (failed)  svc.status.network_fails++;
-    else svc.status.network_fails=0;
-    // if failed more than 2 times in a row, reconnect
-    if (svc.status.network_fails>2&&svc.options[OPTION_NETFAIL_RECONNECT].value) {
-      //svc.lcd_print_line_clear_pgm(PSTR("Reconnecting..."),0);
-      svc.start_network(mymac, myport);
-      //svc.status.network_fails=0;
     }
-.*/
+    return;
+  }
+
   // check network condition periodically
   if (curr_time - last_check_time > CHECK_NETWORK_INTERVAL) 
   {
     last_check_time = curr_time;
 
-    // ping gateway ip  
-    boolean result = ping(2, ether.gwip, tmp_buffer);
-
-    if (result)
-      svc.status.network_fails=0;
-    else
-     svc.status.network_fails++;
-
-    // if failed more than 2 times in a row, reconnect
-    if (svc.status.network_fails>2&&svc.options[OPTION_NETFAIL_RECONNECT].value)
-    {
-      // svc.lcd_print_line_clear_pgm(PSTR("Reconnecting..."),0);
-      svc.start_network(mymac, myport);
-      //svc.status.network_fails=0;
-    }
+    // ping gateway ip; with every socket busy serving clients, the
+    // check is skipped, not counted as a failure
+    if (!ether.clientIcmpRequest(ether.gwip))  return;
+    tries = 1;
+    ping_millis = millis();
   }
-  // ===== Added for W5100 =====
 }
 
 void schedule_all_stations(unsigned long curr_time, byte seq)
@@ -481,6 +558,7 @@ void schedule_all_stations(unsigned long curr_time, byte seq)
         accumulate_time += pd.scheduled_stop_time[sid];
         pd.scheduled_stop_time[sid] = accumulate_time;
         accumulate_time += svc.options[OPTION_STATION_DELAY_TIME].value; // add station delay time
+        pd.queue_station(sid);
         svc.status.program_busy = 1;  // set program busy bit
       }
     }
@@ -493,6 +571,7 @@ void schedule_all_stations(unsigned long curr_time, byte seq)
       if(pd.scheduled_stop_time[sid] && !(svc.station_bits[bid]&(1<<s))) {
         pd.scheduled_start_time[sid] = accumulate_time;
         pd.scheduled_stop_time[sid] = accumulate_time + pd.scheduled_stop_time[sid];
+        pd.queue_station(sid);
         svc.status.program_busy = 1;  // set program busy bit
       }
     }
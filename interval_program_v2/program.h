@@ -13,6 +13,21 @@
 #include "OpenSprinklerGen2.h"
 // ===== Added for W5100 =====
 
+// Calendar breakdown of a time, computed once per tick and
+// shared by all program checks of that tick
+#define TC_EVEN_DAY   0x01  // day of month is even
+#define TC_ODD_DAY    0x02  // day of month is odd (except 31st and Feb 29th)
+
+struct TimeContext {
+  unsigned int day;     // days since 1970-01-01
+  unsigned int minute;  // minute of the day
+  byte weekday;         // weekday (Monday is 0)
+  byte mday;            // day of month
+  byte month;           // month
+  byte flags;           // day parity flags
+  void set(time_t t);
+};
+
 // Program data structure
 class ProgramStruct {
 public:
@@ -33,6 +48,23 @@ public:
   byte enabled;         // program enable
 
   byte check_match(time_t t);
+  byte check_match(const TimeContext &tc);
+  byte check_day_match(const TimeContext &tc);
+  uint16_t next_start(unsigned int minute); // first start time (in minutes) not earlier than minute
+  time_t next_match(time_t from);           // first start time not earlier than from
+};
+
+// returned by next_start() if the program has no start left in the day
+#define START_NONE  0xFFFF
+// maximum number of days next_match() looks ahead for weekly programs
+#define NEXT_MATCH_MAX_DAYS  64
+
+// Compiled schedule entry: the next start of a program that runs today
+struct ScheduleStruct {
+  uint16_t next_minute; // next start time in minutes
+  uint16_t end_time;    // end time in minutes
+  uint16_t interval;    // interval in minutes
+  byte pid;             // program index
 };
 
 // Log data structure
@@ -43,12 +75,57 @@ struct LogStruct {
   unsigned long endtime;
 };
 
-// program structure size
-#define PROGRAMSTRUCT_SIZE   (sizeof(ProgramStruct))
-#define ADDR_PROGRAMCOUNTER  ADDR_EEPROM_USER
-#define ADDR_PROGRAMDATA     (ADDR_EEPROM_USER+2)
-// maximum number of programs, restricted by internal EEPROM size, 32 default
-#define MAX_NUMBER_PROGRAMS  ((INT_EEPROM_SIZE-ADDR_EEPROM_USER-2)/PROGRAMSTRUCT_SIZE)
+// Run log: a ring of LogStruct records in EEPROM, oldest first. Each
+// record is written once per lap; bit 7 of the station byte holds the
+// lap it was written in, so the write position can be found on boot.
+#define LOG_RECORDS          (LOG_EEPROM_SIZE/sizeof(LogStruct))
+#define LOG_LAP_BIT          0x80
+
+// Programs are stored packed in EEPROM: a fixed header followed by one
+// station byte per board, so a slot is PROGRAM_HEADER_SIZE+nboards bytes.
+//   byte 0     days[0]
+//   byte 1     days[1]
+//   byte 2-3   duration
+//   byte 4-7   start_time (bits 0-10), end_time (bits 11-21),
+//              interval (low 10 bits in bits 22-31)
+//   byte 8     interval (bit 10 in bit 0), enabled (bit 1)
+#define PROGRAM_HEADER_SIZE  9
+#define PROGRAM_RECORD_MAX   (PROGRAM_HEADER_SIZE+MAX_EXT_BOARDS+1)
+// number of boards the program slots are currently sized for
+#define ADDR_PROGRAMLAYOUT   ADDR_EEPROM_USER
+// slot table: one byte per program slot, 0 if the slot is free, otherwise
+// the sequence number that puts the program in its place in the list
+#define SLOT_FREE            0
+#define SLOT_NONE            0xFF   // no slot (empty cache line)
+
+#ifdef SD_PROGRAM_STORE
+// programs on SD card: a file of fixed size records (sequence number + program)
+#define MAX_NUMBER_PROGRAMS  SD_MAX_PROGRAMS
+#define SD_RECORD_SIZE       (PROGRAM_RECORD_MAX+1)
+#define SD_CACHE_RECORDS     8      // records kept in the read cache
+#define PROGRAM_SLOTS(nb)    MAX_NUMBER_PROGRAMS
+// starts held in the schedule at a time, the rest are picked up later
+#define SCHEDULE_SIZE        64
+#else
+// maximum number of programs, restricted by internal EEPROM size: each takes
+// a byte in the slot table and a slot, which is smallest with a single board.
+// That gives 96 programs with 1 board down to 64 with 6 (59 for any board
+// count with unpacked records): the slot table and the 9 byte header,
+// which holds 66 bits of fields, keep it well short of twice as many.
+#define MAX_NUMBER_PROGRAMS  ((INT_EEPROM_SIZE-ADDR_EEPROM_USER-1)/(PROGRAM_HEADER_SIZE+2))
+#define SCHEDULE_SIZE        MAX_NUMBER_PROGRAMS
+#define ADDR_PROGRAMSLOTS    (ADDR_EEPROM_USER+1)
+#define ADDR_PROGRAMDATA     (ADDR_PROGRAMSLOTS+MAX_NUMBER_PROGRAMS)
+#define PROGRAM_DATA_SIZE    (INT_EEPROM_SIZE-ADDR_PROGRAMDATA)
+// number of slots that fit in the program area when sized for nb boards
+#define PROGRAM_SLOTS(nb)    ((PROGRAM_DATA_SIZE/(PROGRAM_HEADER_SIZE+(nb)) < MAX_NUMBER_PROGRAMS) ? \
+                              PROGRAM_DATA_SIZE/(PROGRAM_HEADER_SIZE+(nb)) : MAX_NUMBER_PROGRAMS)
+#endif
+// returned by schedule_next() when no program starts at the given minute
+#define SCHEDULE_NONE        0xFF
+// returned by queue_pop() when no station event is due, and used
+// in station_queue_pos[] for stations that are not queued
+#define QUEUE_NONE           0xFF
 
 extern OpenSprinkler svc;
 
@@ -58,6 +135,7 @@ public:
   static unsigned long scheduled_stop_time[]; // scheduled stop time for each station
   static byte scheduled_program_index[]; // scheduled program index
   static byte  nprograms;     // number of programs
+  static byte  nslots;        // number of programs that fit with the current slot size
   static LogStruct lastrun;   // last run log
 
   static void init();
@@ -67,11 +145,72 @@ public:
   static void add(ProgramStruct *buf);
   static void modify(byte pid, ProgramStruct *buf);
   static void del(byte pid);
+  static byte slot(byte pid) { return slot_map[pid]; } // slot of a program, stable until the board count changes
+  static void set_boards(byte nb);      // resize the program slots for nb boards
+  // -- Bulk replace: old programs are freed first and the new ones only
+  // entered in the slot table at the end, so an interrupted import
+  // leaves no half-written programs behind --
+  static void bulk_begin();
+  static void bulk_write(byte pid, ProgramStruct *buf);
+  static void bulk_end(byte n);
+  static unsigned int ram_size();       // RAM taken by this class
   static void drem_to_relative(byte days[2]); // absolute to relative reminder conversion
   static void drem_to_absolute(byte days[2]);
+  static byte schedule_next(time_t t);  // index of the next program starting at time t
+  // -- Station event queue --
+  static byte nqueued;                  // number of stations with a pending start/stop event
+  static void queue_station(byte sid);  // (re)queue a station after its scheduled times have changed
+  static byte queue_pop(unsigned long t); // pop a station whose event is due at time t
+  static unsigned long next_event_time(); // time of the earliest pending event
+  // -- Run log --
+  static unsigned int nlogs;            // number of records in the run log
+  static void log_append(LogStruct *rec);
+  static void log_read(unsigned int k, LogStruct *rec); // k-th record, 0 is the oldest
+  // The log is in time order but for where the clock was last set back,
+  // which splits it in two runs: run 0 before log_base, run 1 from it on
+  static unsigned int log_find(unsigned long t, byte run); // first record of a run that ended at or after t
+  static unsigned int log_run_end(byte run) { return run ? nlogs : log_base; }
 private:  
-  static void load_count();
-  static void save_count();
+  static byte slot_map[];   // slot of each program, in list order
+  static byte slot_used[];  // slot allocation bitmap
+  static byte next_seq;     // sequence number for the next program added
+  static byte layout;       // number of boards the slots are sized for
+  static void pack(const ProgramStruct *prog, byte *rec);
+  static void unpack(const byte *rec, ProgramStruct *prog);
+  static void read_record(byte slot, byte *rec);
+  static void write_record(byte slot, const byte *rec);
+  static byte read_seq(byte slot);
+  static void write_seq(byte slot, byte seq);
+#ifdef SD_PROGRAM_STORE
+  static void store_begin();
+#endif
+  static void load_slots();
+  static void free_all();
+  static void set_seq(byte slot, byte seq);
+  static unsigned int slot_addr(byte slot);
+  static unsigned int log_head;   // where the next record goes
+  static unsigned int log_base;   // first record since the clock was last set back
+  static byte log_lap;            // lap bit of the next record
+  static void log_init();
+  static void schedule_compile(time_t t);
+  static void schedule_insert(ScheduleStruct *entry);
+  static void schedule_advance();
+  static ScheduleStruct schedule[]; // today's program starts, sorted by time
+  static byte nscheduled;           // number of entries in the schedule
+  static unsigned int schedule_horizon; // earliest start left out of a full schedule
+  static byte schedule_horizon_pid;     // and its program
+  static unsigned int schedule_done;    // last start handed out today (START_NONE if none)
+  static byte schedule_done_pid;        // and its program
+  static byte schedule_dirty;       // set when program data has changed
+  static unsigned int schedule_day;     // day (since 1970-01-01) the schedule is compiled for
+  static unsigned int schedule_minute;  // last minute the schedule was checked at
+  static byte station_queue[];      // min-heap of stations, keyed by event time
+  static byte station_queue_pos[];  // heap position of each station
+  static unsigned long event_time(byte sid);
+  static byte queue_less(byte i, byte j);
+  static void queue_swap(byte i, byte j);
+  static void queue_sift(byte i);
+  static void queue_remove(byte i);
 };
 
 #endif
@@ -7,22 +7,79 @@
 
 #include <limits.h>
 #include "program.h"
+#ifdef SD_PROGRAM_STORE
+#include <SD.h>
+#endif
+
+extern char tmp_buffer[];
+
+#if MAX_NUMBER_PROGRAMS > TMP_BUFFER_SIZE
+#error "load_slots() sorts the programs in tmp_buffer, which is too small"
+#endif
 
 // Declaure static data members
 byte ProgramData::nprograms = 0;
+byte ProgramData::nslots = 0;
+byte ProgramData::layout = 1;
+byte ProgramData::slot_map[MAX_NUMBER_PROGRAMS];
+byte ProgramData::slot_used[(MAX_NUMBER_PROGRAMS+7)/8];
+byte ProgramData::next_seq = 1;
 LogStruct ProgramData::lastrun;
+unsigned int ProgramData::nlogs = 0;
+unsigned int ProgramData::log_head = 0;
+unsigned int ProgramData::log_base = 0;
+byte ProgramData::log_lap = 0;
 unsigned long ProgramData::scheduled_start_time[(MAX_EXT_BOARDS+1)*8];
 unsigned long ProgramData::scheduled_stop_time[(MAX_EXT_BOARDS+1)*8];
 byte ProgramData::scheduled_program_index[(MAX_EXT_BOARDS+1)*8];
+ScheduleStruct ProgramData::schedule[SCHEDULE_SIZE];
+byte ProgramData::nscheduled = 0;
+unsigned int ProgramData::schedule_horizon = START_NONE;
+byte ProgramData::schedule_horizon_pid = 0;
+unsigned int ProgramData::schedule_done = START_NONE;
+byte ProgramData::schedule_done_pid = 0;
+byte ProgramData::schedule_dirty = 1;
+unsigned int ProgramData::schedule_day = 0;
+unsigned int ProgramData::schedule_minute = 0;
+byte ProgramData::station_queue[(MAX_EXT_BOARDS+1)*8];
+byte ProgramData::station_queue_pos[(MAX_EXT_BOARDS+1)*8];
+byte ProgramData::nqueued = 0;
+#ifdef SD_PROGRAM_STORE
+static File store;                          // program file on the SD card
+static byte cache_slot[SD_CACHE_RECORDS];   // slot held by each cache line
+static byte cache_rec[SD_CACHE_RECORDS][PROGRAM_RECORD_MAX];
+#endif
+
+// RAM taken by the static data above, for the memory report: a static
+// added to this file must be added to the list too
+unsigned int ProgramData::ram_size() {
+  return sizeof(nprograms) + sizeof(nslots) + sizeof(layout) + sizeof(slot_map) +
+         sizeof(slot_used) + sizeof(next_seq) + sizeof(lastrun) + sizeof(nlogs) +
+         sizeof(log_head) + sizeof(log_base) + sizeof(log_lap) + sizeof(scheduled_start_time) +
+         sizeof(scheduled_stop_time) + sizeof(scheduled_program_index) + sizeof(schedule) +
+         sizeof(nscheduled) + sizeof(schedule_horizon) + sizeof(schedule_horizon_pid) +
+         sizeof(schedule_done) + sizeof(schedule_done_pid) + sizeof(schedule_dirty) +
+         sizeof(schedule_day) + sizeof(schedule_minute) + sizeof(station_queue) +
+         sizeof(station_queue_pos) + sizeof(nqueued)
+#ifdef SD_PROGRAM_STORE
+         + sizeof(store) + sizeof(cache_slot) + sizeof(cache_rec)
+#endif
+         ;
+}
 
 void ProgramData::init() {
   reset_runtime();
-  load_count();
+#ifdef SD_PROGRAM_STORE
+  store_begin();
+#endif
+  load_slots();
+  set_boards(svc.nboards);
   // reset log variables
   lastrun.station = 0;
   lastrun.program = 0;
   lastrun.duration = 0;
   lastrun.endtime = 0;  
+  log_init();
 }
 
 void ProgramData::reset_runtime() {
@@ -30,117 +87,744 @@ void ProgramData::reset_runtime() {
     scheduled_start_time[i] = 0;
     scheduled_stop_time[i] = 0;
     scheduled_program_index[i] = 0;
+    station_queue_pos[i] = QUEUE_NONE;
+  }
+  nqueued = 0;
+}
+
+#ifdef SD_PROGRAM_STORE
+// ====== Program store on SD card ======
+// One file of fixed size records, one per slot: the sequence number
+// followed by the packed program, sized for all boards. Recently read
+// records are kept in a small direct-mapped cache, so reading a
+// program costs at most one seek. The file and the cache are defined
+// with the other statics at the top of this file.
+
+static void store_seek(byte slot, byte offset) {
+  store.seek((unsigned long)slot * SD_RECORD_SIZE + offset);
+}
+
+// open the program file, creating it (all slots free) if it is missing
+// or if the EEPROM has been reset
+void ProgramData::store_begin() {
+  memset(cache_slot, SLOT_NONE, SD_CACHE_RECORDS);
+  // the W5100 shares the SPI bus and is not set up yet: keep it off the bus
+  pinMode(PIN_ETHER_CS, OUTPUT);
+  digitalWrite(PIN_ETHER_CS, HIGH);
+  if (!SD.begin(PIN_SD_CS))  return;
+  store = SD.open(SD_PROGRAM_FILE, FILE_WRITE);
+  if (!store)  return;
+  if (store.size() < (unsigned long)MAX_NUMBER_PROGRAMS * SD_RECORD_SIZE ||
+      eeprom_read_byte((unsigned char *) ADDR_PROGRAMLAYOUT) == 0) {
+    store_seek(0, 0);
+    for (unsigned int i=0; i<MAX_NUMBER_PROGRAMS * SD_RECORD_SIZE; i++)
+      store.write((uint8_t)0);
+    store.flush();
+    svc.eeprom_put_byte(ADDR_PROGRAMLAYOUT, MAX_EXT_BOARDS+1);
   }
 }
 
-// load program count from EEPROM
-void ProgramData::load_count() {
-  nprograms = eeprom_read_byte((unsigned char *) ADDR_PROGRAMCOUNTER);
+byte ProgramData::read_seq(byte slot) {
+  store_seek(slot, 0);
+  return store.read();
+}
+
+void ProgramData::write_seq(byte slot, byte seq) {
+  store_seek(slot, 0);
+  store.write(seq);
+  store.flush();
+}
+
+void ProgramData::read_record(byte slot, byte *rec) {
+  byte line = slot % SD_CACHE_RECORDS;
+  if (cache_slot[line] != slot) {
+    store_seek(slot, 1);
+    store.read(cache_rec[line], PROGRAM_RECORD_MAX);
+    cache_slot[line] = slot;
+  }
+  memcpy(rec, cache_rec[line], PROGRAM_RECORD_MAX);
+}
+
+void ProgramData::write_record(byte slot, const byte *rec) {
+  byte line = slot % SD_CACHE_RECORDS;
+  store_seek(slot, 1);
+  store.write(rec, PROGRAM_RECORD_MAX);
+  store.flush();
+  memcpy(cache_rec[line], rec, PROGRAM_RECORD_MAX);
+  cache_slot[line] = slot;
+}
+
+#else
+// EEPROM address of a program slot
+unsigned int ProgramData::slot_addr(byte slot) {
+  return ADDR_PROGRAMDATA + (unsigned int)slot * (PROGRAM_HEADER_SIZE+layout);
+}
+
+byte ProgramData::read_seq(byte slot) {
+  return eeprom_read_byte((unsigned char *) (uintptr_t) (ADDR_PROGRAMSLOTS+slot));
+}
+
+void ProgramData::write_seq(byte slot, byte seq) {
+  svc.eeprom_put_byte(ADDR_PROGRAMSLOTS+slot, seq);
+}
+
+void ProgramData::read_record(byte slot, byte *rec) {
+  eeprom_read_block((void*)rec, (const void *)(uintptr_t)slot_addr(slot), PROGRAM_HEADER_SIZE+layout);
+}
+
+void ProgramData::write_record(byte slot, const byte *rec) {
+  svc.eeprom_put(slot_addr(slot), rec, PROGRAM_HEADER_SIZE+layout);
+}
+#endif
+
+// encode a program into its EEPROM record
+void ProgramData::pack(const ProgramStruct *prog, byte *rec) {
+  unsigned long t = (unsigned long)(prog->start_time&0x7ff) |
+                    ((unsigned long)(prog->end_time&0x7ff)<<11) |
+                    ((unsigned long)(prog->interval&0x3ff)<<22);
+  rec[0] = prog->days[0];
+  rec[1] = prog->days[1];
+  rec[2] = prog->duration & 0xff;
+  rec[3] = prog->duration >> 8;
+  rec[4] = t & 0xff;
+  rec[5] = (t>>8) & 0xff;
+  rec[6] = (t>>16) & 0xff;
+  rec[7] = t>>24;
+  rec[8] = ((prog->interval>>10)&0x01) | (prog->enabled ? 0x02 : 0);
+  memcpy(rec+PROGRAM_HEADER_SIZE, prog->stations, layout);
+}
+
+// decode an EEPROM record into a program
+void ProgramData::unpack(const byte *rec, ProgramStruct *prog) {
+  unsigned long t = (unsigned long)rec[4] | ((unsigned long)rec[5]<<8) |
+                    ((unsigned long)rec[6]<<16) | ((unsigned long)rec[7]<<24);
+  prog->days[0] = rec[0];
+  prog->days[1] = rec[1];
+  prog->duration = (uint16_t)rec[2] | ((uint16_t)rec[3]<<8);
+  prog->start_time = t & 0x7ff;
+  prog->end_time = (t>>11) & 0x7ff;
+  prog->interval = ((t>>22) & 0x3ff) | ((uint16_t)(rec[8]&0x01)<<10);
+  prog->enabled = (rec[8]>>1) & 0x01;
+  memcpy(prog->stations, rec+PROGRAM_HEADER_SIZE, layout);
+  memset(prog->stations+layout, 0, MAX_EXT_BOARDS+1-layout);
+}
+
+// mark a slot used (with its sequence number) or free
+void ProgramData::set_seq(byte slot, byte seq) {
+  write_seq(slot, seq);
+  if (seq == SLOT_FREE)  slot_used[slot>>3] &= ~(1<<(slot&7));
+  else                   slot_used[slot>>3] |= (1<<(slot&7));
+}
+
+// build the slot map from the slot table,
+// ordering the programs by their sequence numbers
+void ProgramData::load_slots() {
+  byte slot, seq, i;
+  // sequence numbers of the programs in list order, kept in the
+  // scratch buffer (nothing else uses it while programs are loaded)
+  byte *seqs = (byte *)tmp_buffer;
+#ifdef SD_PROGRAM_STORE
+  layout = MAX_EXT_BOARDS+1;
+  nslots = store ? MAX_NUMBER_PROGRAMS : 0;
+#else
+  layout = eeprom_read_byte((unsigned char *) ADDR_PROGRAMLAYOUT);
+  if (layout == 0 || layout > MAX_EXT_BOARDS+1) {
+    // fresh EEPROM: size the (empty) slots for the current boards
+    layout = svc.nboards;
+    svc.eeprom_put_byte(ADDR_PROGRAMLAYOUT, layout);
+  }
+  nslots = PROGRAM_SLOTS(layout);
+#endif
+  nprograms = 0;
+  next_seq = 1;
+  memset(slot_used, 0, (MAX_NUMBER_PROGRAMS+7)/8);
+  for (slot=0; slot<nslots; slot++) {
+    seq = read_seq(slot);
+    if (seq == SLOT_FREE)  continue;
+    slot_used[slot>>3] |= (1<<(slot&7));
+    if (seq >= next_seq)  next_seq = seq+1;
+    // insertion sort by sequence number
+    for (i=nprograms; i>0 && seqs[i-1]>seq; i--) {
+      seqs[i] = seqs[i-1];
+      slot_map[i] = slot_map[i-1];
+    }
+    seqs[i] = seq;
+    slot_map[i] = slot;
+    nprograms++;
+  }
 }
 
-// save program count to EEPROM
-void ProgramData::save_count() {
-  eeprom_write_byte((unsigned char *) ADDR_PROGRAMCOUNTER, nprograms);
+// free the slots of all programs
+void ProgramData::free_all() {
+  for (byte pid=0; pid<nprograms; pid++)
+    set_seq(slot_map[pid], SLOT_FREE);
+  nprograms = 0;
+  next_seq = 1;
+  schedule_dirty = 1;
 }
 
 // erase all program data
 void ProgramData::erase() {
-  /*byte zero = 0;
-   for(unsigned int addr=ADDR_PROGRAMDATA; addr<ADDR_PROGRAMDATA+(nprograms*PROGRAMSTRUCT_SIZE); addr++)
-   eeprom_write_block((const void*)&zero, (void *)addr, 1);*/
-  // no need to wipe data, just set count to 0
-  nprograms = 0;
-  save_count();
+  // no need to wipe data, just free the slots
+  free_all();
 }
 
 // read a program
 void ProgramData::read(byte pid, ProgramStruct *buf) {
   if (pid >= nprograms) return;
-  unsigned int addr = ADDR_PROGRAMDATA + (unsigned int)pid * PROGRAMSTRUCT_SIZE;
-  eeprom_read_block((void*)buf, (const void *)addr, PROGRAMSTRUCT_SIZE);  
+  byte rec[PROGRAM_RECORD_MAX];
+  read_record(slot_map[pid], rec);
+  unpack(rec, buf);
 }
 
-// add a program
+// add a program in the first free slot, at the end of the list
 void ProgramData::add(ProgramStruct *buf) {
-  if (nprograms >= MAX_NUMBER_PROGRAMS)  return;
-  unsigned int addr = ADDR_PROGRAMDATA + (unsigned int)nprograms * PROGRAMSTRUCT_SIZE;
-  eeprom_write_block((const void*)buf, (void *)addr, PROGRAMSTRUCT_SIZE);
-  nprograms ++;
-  save_count();
+  if (nprograms >= nslots)  return;
+  byte rec[PROGRAM_RECORD_MAX];
+  byte slot = 0;
+  while (slot_used[slot>>3] & (1<<(slot&7)))  slot++;
+  if (next_seq == 0) {
+    // sequence numbers ran out: renumber the programs in list order
+    for (byte pid=0; pid<nprograms; pid++)
+      set_seq(slot_map[pid], pid+1);
+    next_seq = nprograms+1;
+  }
+  // the data goes in before the slot is marked used
+  pack(buf, rec);
+  write_record(slot, rec);
+  set_seq(slot, next_seq++);
+  slot_map[nprograms++] = slot;
+  schedule_dirty = 1;
 }
 
 // modify a program
 void ProgramData::modify(byte pid, ProgramStruct *buf) {
   if (pid >= nprograms)  return;
-  unsigned int addr = ADDR_PROGRAMDATA + (unsigned int)pid * PROGRAMSTRUCT_SIZE;
-  eeprom_write_block((const void*)buf, (void *)addr, PROGRAMSTRUCT_SIZE);
+  byte rec[PROGRAM_RECORD_MAX];
+  pack(buf, rec);
+  write_record(slot_map[pid], rec);
+  schedule_dirty = 1;
 }
 
-// delete program(s)
+// delete a program: a single write to free its slot
 void ProgramData::del(byte pid) {
   if (pid >= nprograms)  return;
-  if (nprograms == 0) return;
-  ProgramStruct copy;
-  unsigned int addr = ADDR_PROGRAMDATA + (unsigned int)(pid+1) * PROGRAMSTRUCT_SIZE;
-  // erase by copying backward
-  for (; addr < ADDR_PROGRAMDATA + nprograms * PROGRAMSTRUCT_SIZE; addr += PROGRAMSTRUCT_SIZE) {
-    eeprom_read_block((void*)&copy, (const void *)addr, PROGRAMSTRUCT_SIZE);  
-    eeprom_write_block((const void*)&copy, (void *)(addr-PROGRAMSTRUCT_SIZE), PROGRAMSTRUCT_SIZE);
-  }
+  set_seq(slot_map[pid], SLOT_FREE);
   nprograms --;
-  save_count();
+  memmove(slot_map+pid, slot_map+pid+1, nprograms-pid);
+  schedule_dirty = 1;
+}
+
+// start replacing all programs
+void ProgramData::bulk_begin() {
+  free_all();
+}
+
+// write a program during a bulk replace (into slot pid)
+void ProgramData::bulk_write(byte pid, ProgramStruct *buf) {
+  if (pid >= nslots)  return;
+  byte rec[PROGRAM_RECORD_MAX];
+  pack(buf, rec);
+  write_record(pid, rec);
+}
+
+// finish a bulk replace with n programs written
+void ProgramData::bulk_end(byte n) {
+  if (n > nslots)  n = nslots;
+  for (nprograms=0; nprograms<n; nprograms++) {
+    set_seq(nprograms, nprograms+1);
+    slot_map[nprograms] = nprograms;
+  }
+  next_seq = n+1;
+  schedule_dirty = 1;
+}
+
+// Resize the program slots for nb boards, after the number of extension
+// boards has changed. The programs are moved to the lowest slots and then
+// resized, keeping the station bits of the boards that remain. Nothing is
+// changed if they would not all fit (the caller refuses such a change).
+void ProgramData::set_boards(byte nb) {
+#ifndef SD_PROGRAM_STORE  // records on the card hold all boards, there is nothing to resize
+  if (nb == layout || nprograms > PROGRAM_SLOTS(nb))  return;
+  byte rec[PROGRAM_RECORD_MAX];
+  byte slot, n, i, old = layout;
+
+  // close the gaps at the old size, records only move down
+  for (slot=0, n=0; slot<nslots; slot++) {
+    if (!(slot_used[slot>>3] & (1<<(slot&7))))  continue;
+    if (slot != n) {
+      read_record(slot, rec);
+      write_record(n, rec);
+      set_seq(n, read_seq(slot));
+      set_seq(slot, SLOT_FREE);
+    }
+    n++;
+  }
+
+  // resize: shrinking moves records down so start from the first,
+  // growing moves them up so start from the last
+  for (i=0; i<n; i++) {
+    slot = (nb < old) ? i : n-1-i;
+    layout = old;
+    read_record(slot, rec);
+    if (nb > old)  memset(rec+PROGRAM_HEADER_SIZE+old, 0, nb-old);
+    layout = nb;
+    write_record(slot, rec);
+  }
+  svc.eeprom_put_byte(ADDR_PROGRAMLAYOUT, nb);
+  load_slots();
+  schedule_dirty = 1;
+#endif
+}
+
+// Break down a time into the fields used by program checks
+void TimeContext::set(time_t t) {
+  tmElements_t tm;
+  breakTime(t, tm);
+  day = t / SECS_PER_DAY;
+  minute = (unsigned int)tm.Hour*60+(unsigned int)tm.Minute;
+  weekday = (tm.Wday+5)%7;  // Time::weekday() assumes Sunday is 1
+  mday = tm.Day;
+  month = tm.Month;
+  if ((mday%2)==0) {
+    flags = TC_EVEN_DAY;
+  }
+  else if (mday==31 || (mday==29 && month==2)) {
+    // odd day restriction skips 31st and Feb 29
+    flags = 0;
+  }
+  else {
+    flags = TC_ODD_DAY;
+  }
 }
 
 // Check if a given time matches program schedule
 byte ProgramStruct::check_match(time_t t) {
+  TimeContext tc;
+  tc.set(t);
+  return check_match(tc);
+}
 
-  unsigned int current_minute = (unsigned int)hour(t)*60+(unsigned int)minute(t);
+// Check if a broken-down time matches program schedule
+byte ProgramStruct::check_match(const TimeContext &tc) {
 
   // check program enable status
   if (enabled == 0) return 0;
 
   // check day match
+  if (!check_day_match(tc))  return 0;
+
+  // check start and end time
+  if (tc.minute < start_time || tc.minute > end_time)
+    return 0;
+
+  // check interval match
+  if (interval == 0)  return 0;
+  if (((tc.minute - start_time) / interval) * interval ==
+    (tc.minute - start_time)) {
+    // program matched
+    return 1;
+  }
+  return 0;
+}
+
+// Check if the day of a broken-down time matches program days
+byte ProgramStruct::check_day_match(const TimeContext &tc) {
   // if special program bit is set, and interval is larger than 1
   if ((days[0]&0x80)&&(days[1]>1)) {
     // this is an inverval program
     byte dn   =days[1];      // interval
     byte drem =days[0]&0x7f; // remainder, relative to 1970-01-01
-    if (((t/SECS_PER_DAY)%dn) != drem)  return 0;
+    if ((tc.day%dn) != drem)  return 0;
   } 
   else {
     // this is a weekly program
-    byte wd = ((byte)weekday(t)+5)%7;
     // weekday match
-    if (!(days[0] & (1<<wd)))
+    if (!(days[0] & (1<<tc.weekday)))
       return 0;
-    byte dt=day(t);
     if ((days[0]&0x80)&&(days[1]==0)) {
       // even day restriction
-      if((dt%2)!=0)  return 0;
+      if (!(tc.flags&TC_EVEN_DAY))  return 0;
     }
     if ((days[0]&0x80)&&(days[1]==1)) {
       // odd day restriction
-      // skip 31st and Feb 29
-      if(dt==31)  return 0;
-      else if (dt==29 && month(t)==2)  return 0;
-      else if ((dt%2)!=1)  return 0;
+      if (!(tc.flags&TC_ODD_DAY))  return 0;
     }
   }
+  return 1;
+}
 
-  // check start and end time
-  if (current_minute < start_time || current_minute > end_time)
-    return 0;
+// First start time (in minutes) that is not earlier than a given minute
+// of the day, or START_NONE if there is none left in the day
+uint16_t ProgramStruct::next_start(unsigned int minute) {
+  if (interval == 0)  return START_NONE;
+  uint16_t m = start_time;
+  if (minute > start_time) {
+    m += (minute - start_time + interval - 1) / interval * interval;
+  }
+  if (m > end_time || m >= 1440)  return START_NONE;
+  return m;
+}
 
-  // check interval match
-  if (interval == 0)  return 0;
-  if (((current_minute - start_time) / interval) * interval ==
-    (current_minute - start_time)) {
-    // program matched
-    return 1;
+// Compute the first start time that is not earlier than 'from'
+// directly from the day rules, instead of checking minute by minute.
+// Returns 0 if the program does not run.
+time_t ProgramStruct::next_match(time_t from) {
+  if (enabled == 0 || next_start(0) == START_NONE)  return 0;
+
+  unsigned int d = from / SECS_PER_DAY;
+  unsigned int minute = (from % SECS_PER_DAY + 59) / 60;  // round up to a whole minute
+  uint16_t m;
+
+  if ((days[0]&0x80)&&(days[1]>1)) {
+    // interval program: jump to the next day with a matching remainder
+    byte dn   =days[1];
+    byte drem =days[0]&0x7f;
+    d += (drem + dn - d%dn) % dn;
+    if (d != from / SECS_PER_DAY)  minute = 0;
+    m = next_start(minute);
+    if (m == START_NONE) {
+      // no start left today, go to the next interval
+      d += dn;
+      m = next_start(0);
+    }
+    return (time_t)d*SECS_PER_DAY + (time_t)m*60;
+  }
+
+  // weekly program: check weekdays first, the calendar
+  // only needs to be broken down for odd/even restrictions
+  if ((days[0]&0x7f) == 0)  return 0;
+  TimeContext tc;
+  for (byte i=0; i<NEXT_MATCH_MAX_DAYS; i++, d++, minute=0) {
+    if (!(days[0] & (1<<((d+3)%7))))  continue;  // 1970-01-01 is a Thursday
+    if (days[0]&0x80) {
+      tc.set((time_t)d*SECS_PER_DAY);
+      if (!check_day_match(tc))  continue;
+    }
+    m = next_start(minute);
+    if (m != START_NONE)  return (time_t)d*SECS_PER_DAY + (time_t)m*60;
   }
   return 0;
 }
 
+// ================
+// Schedule Compiler
+// ================
+// Instead of reading and matching every program each minute,
+// the programs that run today are compiled into a table of
+// their next start times, sorted by time. The table is rebuilt
+// once a day, or whenever program data has changed, so the
+// per-minute check only needs to look at the first entry.
+
+// Starts are ordered by minute, then program index
+static boolean start_before(unsigned int m1, byte pid1, unsigned int m2, byte pid2) {
+  return (m1 < m2 || (m1 == m2 && pid1 < pid2));
+}
+
+// Return the index of the next program starting at time t,
+// or SCHEDULE_NONE if no (more) program starts at this minute.
+// Call repeatedly until SCHEDULE_NONE to get all matches.
+byte ProgramData::schedule_next(time_t t) {
+  unsigned int current_day = t / SECS_PER_DAY;
+  unsigned int current_minute = (t % SECS_PER_DAY) / 60;
+
+  // on a new day, or if time has gone backward, every start is due again
+  if (current_day != schedule_day || current_minute < schedule_minute) {
+    schedule_done = START_NONE;
+    schedule_dirty = 1;
+  }
+  // skip start times that have passed without being checked
+  // (e.g. while a sequential program was running)
+  while (nscheduled > 0 && schedule[0].next_minute < current_minute) {
+    schedule_advance();
+  }
+  // rebuild after program changes, or when the starts that did not fit
+  // in the table are next (the ones it still holds come before them)
+  if (schedule_dirty || (current_minute >= schedule_horizon && (nscheduled == 0 ||
+      start_before(schedule_horizon, schedule_horizon_pid, schedule[0].next_minute, schedule[0].pid)))) {
+    schedule_compile(t);
+  }
+  schedule_minute = current_minute;
+
+  if (nscheduled > 0 && schedule[0].next_minute == current_minute) {
+    byte pid = schedule[0].pid;
+    schedule_done = current_minute;
+    schedule_done_pid = pid;
+    schedule_advance();
+    return pid;
+  }
+  return SCHEDULE_NONE;
+}
+
+// Build the table of programs that run on the day of time t,
+// from the current minute on, leaving out the starts already handed out
+void ProgramData::schedule_compile(time_t t) {
+  ProgramStruct prog;
+  ScheduleStruct entry;
+  TimeContext tc;
+  tc.set(t);
+  unsigned int current_minute = tc.minute;
+
+  nscheduled = 0;
+  schedule_horizon = START_NONE;
+  for (byte pid=0; pid<nprograms; pid++) {
+    read(pid, &prog);
+    if (prog.enabled == 0 || prog.interval == 0 || prog.duration == 0)  continue;
+    if (!prog.check_day_match(tc))  continue;
+
+    // find the first start time that is not earlier than the current minute
+    entry.next_minute = prog.next_start(current_minute);
+    if (entry.next_minute != START_NONE && schedule_done != START_NONE &&
+        !start_before(schedule_done, schedule_done_pid, entry.next_minute, pid)) {
+      entry.next_minute = prog.next_start(entry.next_minute+1);
+    }
+    if (entry.next_minute == START_NONE)  continue;
+    entry.end_time = prog.end_time;
+    entry.interval = prog.interval;
+    entry.pid = pid;
+    schedule_insert(&entry);
+  }
+  schedule_day = tc.day;
+  schedule_minute = current_minute;
+  schedule_dirty = 0;
+}
+
+// Insert an entry, keeping the table sorted by start time, then program index.
+// If the table is full the latest start is left out, and the schedule is
+// rebuilt when its turn comes (see schedule_horizon).
+void ProgramData::schedule_insert(ScheduleStruct *entry) {
+  if (nscheduled == SCHEDULE_SIZE) {
+    ScheduleStruct *last = &schedule[nscheduled-1];
+    if (start_before(last->next_minute, last->pid, entry->next_minute, entry->pid)) {
+      if (start_before(entry->next_minute, entry->pid, schedule_horizon, schedule_horizon_pid)) {
+        schedule_horizon = entry->next_minute;
+        schedule_horizon_pid = entry->pid;
+      }
+      return;
+    }
+    if (start_before(last->next_minute, last->pid, schedule_horizon, schedule_horizon_pid)) {
+      schedule_horizon = last->next_minute;
+      schedule_horizon_pid = last->pid;
+    }
+    nscheduled --;
+  }
+  byte i = nscheduled;
+  while (i > 0 && start_before(entry->next_minute, entry->pid, schedule[i-1].next_minute, schedule[i-1].pid)) {
+    schedule[i] = schedule[i-1];
+    i--;
+  }
+  schedule[i] = *entry;
+  nscheduled ++;
+}
+
+// Move the first entry to its next start time, or remove it if it has no more starts today
+void ProgramData::schedule_advance() {
+  ScheduleStruct entry = schedule[0];
+  byte i;
+  nscheduled --;
+  for (i=0; i<nscheduled; i++) {
+    schedule[i] = schedule[i+1];
+  }
+  entry.next_minute += entry.interval;
+  if (entry.next_minute <= entry.end_time && entry.next_minute < 1440) {
+    schedule_insert(&entry);
+  }
+}
+
+// ===================
+// Station Event Queue
+// ===================
+// Every station with a non-zero stop time has exactly one pending
+// event in the queue: its start time if it is not running, or its
+// stop time if it is. The queue is a binary min-heap ordered by
+// event time (then station index), so the runner only touches
+// stations whose events are due, and the next wake-up time is
+// always at the top.
+
+// Time of the pending event of a station
+unsigned long ProgramData::event_time(byte sid) {
+  if (svc.station_bits[sid>>3]&(1<<(sid&0x07)))
+    return scheduled_stop_time[sid];
+  return scheduled_start_time[sid];
+}
+
+// Compare two heap positions
+byte ProgramData::queue_less(byte i, byte j) {
+  unsigned long ti = event_time(station_queue[i]);
+  unsigned long tj = event_time(station_queue[j]);
+  if (ti != tj)  return (ti < tj);
+  return (station_queue[i] < station_queue[j]);
+}
+
+// Swap two heap positions
+void ProgramData::queue_swap(byte i, byte j) {
+  byte sid = station_queue[i];
+  station_queue[i] = station_queue[j];
+  station_queue[j] = sid;
+  station_queue_pos[station_queue[i]] = i;
+  station_queue_pos[station_queue[j]] = j;
+}
+
+// Restore heap order after the event time at position i has changed
+void ProgramData::queue_sift(byte i) {
+  byte c;
+  // move up
+  while (i > 0 && queue_less(i, (i-1)/2)) {
+    queue_swap(i, (i-1)/2);
+    i = (i-1)/2;
+  }
+  // move down
+  while ((c = 2*i+1) < nqueued) {
+    if (c+1 < nqueued && queue_less(c+1, c))  c++;
+    if (!queue_less(c, i))  break;
+    queue_swap(i, c);
+    i = c;
+  }
+}
+
+// Remove the station at heap position i
+void ProgramData::queue_remove(byte i) {
+  station_queue_pos[station_queue[i]] = QUEUE_NONE;
+  nqueued --;
+  if (i == nqueued)  return;
+  station_queue[i] = station_queue[nqueued];
+  station_queue_pos[station_queue[i]] = i;
+  queue_sift(i);
+}
+
+// Call this whenever the scheduled times (or the running state) of a station
+// have changed: the station is queued if it has a stop time, otherwise removed
+void ProgramData::queue_station(byte sid) {
+  byte i = station_queue_pos[sid];
+  if (scheduled_stop_time[sid] == 0) {
+    if (i != QUEUE_NONE)  queue_remove(i);
+    return;
+  }
+  if (i == QUEUE_NONE) {
+    i = nqueued++;
+    station_queue[i] = sid;
+    station_queue_pos[sid] = i;
+  }
+  queue_sift(i);
+}
+
+// Pop the station with the earliest event if it is due at time t,
+// otherwise return QUEUE_NONE
+byte ProgramData::queue_pop(unsigned long t) {
+  if (nqueued == 0 || event_time(station_queue[0]) > t)  return QUEUE_NONE;
+  byte sid = station_queue[0];
+  queue_remove(0);
+  return sid;
+}
+
+// Time of the earliest pending station event, ULONG_MAX if there is none
+unsigned long ProgramData::next_event_time() {
+  if (nqueued == 0)  return ULONG_MAX;
+  return event_time(station_queue[0]);
+}
+
+// =======
+// Run Log
+// =======
+// Every station run is appended to a ring of records above the
+// program area. Records go in time order, so the ones in a time
+// range are found by binary search.
+static unsigned int log_addr(unsigned int pos) {
+  return ADDR_EEPROM_LOG + pos * sizeof(LogStruct);
+}
+
+// a record never written (erased or reset eeprom)
+static boolean log_empty(LogStruct *rec) {
+  return (rec->endtime == 0 || rec->endtime == ULONG_MAX);
+}
+
+// Find the write position: the first record that is empty or
+// written in a different lap than the first one
+void ProgramData::log_init() {
+  LogStruct rec;
+  byte lap0;
+  unsigned long t;
+  nlogs = 0;
+  log_head = 0;
+  log_base = 0;
+  log_lap = 0;
+  if (LOG_RECORDS == 0)  return;
+  eeprom_read_block((void*)&rec, (const void *)(uintptr_t)log_addr(0), sizeof(LogStruct));
+  if (log_empty(&rec))  return;
+  lap0 = rec.station & LOG_LAP_BIT;
+  log_lap = lap0;
+  nlogs = LOG_RECORDS;
+  for (log_head=1; log_head<LOG_RECORDS; log_head++) {
+    eeprom_read_block((void*)&rec, (const void *)(uintptr_t)log_addr(log_head), sizeof(LogStruct));
+    if (log_empty(&rec)) {
+      nlogs = log_head;
+      break;
+    }
+    if ((rec.station & LOG_LAP_BIT) != lap0)  break;
+  }
+  if (log_head == LOG_RECORDS) {
+    // a lap has just been completed
+    log_head = 0;
+    log_lap ^= LOG_LAP_BIT;
+  }
+  // the newest record is the last run
+  log_read(nlogs-1, &lastrun);
+  // going back from it, find where the clock was last set back
+  t = lastrun.endtime;
+  for (log_base=nlogs-1; log_base>0; log_base--) {
+    log_read(log_base-1, &rec);
+    if (rec.endtime > t)  break;
+    t = rec.endtime;
+  }
+}
+
+void ProgramData::log_append(LogStruct *rec) {
+  LogStruct r;
+  boolean set_back = false;
+  if (LOG_RECORDS == 0)  return;
+  r = *rec;
+  // records keep their real end time; if the clock has been set back,
+  // time searches start again from this record (see log_find)
+  if (nlogs > 0) {
+    LogStruct last;
+    log_read(nlogs-1, &last);
+    set_back = (r.endtime < last.endtime);
+  }
+  r.station |= log_lap;
+  svc.eeprom_put(log_addr(log_head), &r, sizeof(LogStruct));
+  if (++log_head == LOG_RECORDS) {
+    log_head = 0;
+    log_lap ^= LOG_LAP_BIT;
+  }
+  if (nlogs < LOG_RECORDS)  nlogs++;
+  else if (log_base > 0)  log_base--;   // the oldest record was overwritten
+  if (set_back)  log_base = nlogs-1;
+}
+
+void ProgramData::log_read(unsigned int k, LogStruct *rec) {
+  unsigned int pos = log_head + LOG_RECORDS - nlogs + k;
+  if (pos >= LOG_RECORDS)  pos -= LOG_RECORDS;
+  eeprom_read_block((void*)rec, (const void *)(uintptr_t)log_addr(pos), sizeof(LogStruct));
+  rec->station &= ~LOG_LAP_BIT;
+}
+
+// Index of the first record of a run that ended at or after time t, the
+// end of the run if there is none. Each run is searched on its own since
+// only within one are the end times in order. (If the clock was set back
+// more than once, run 0 is not all in order and a search may miss some
+// of its records.)
+unsigned int ProgramData::log_find(unsigned long t, byte run) {
+  unsigned int lo = run ? log_base : 0, hi = log_run_end(run), mid;
+  LogStruct rec;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    log_read(mid, &rec);
+    if (rec.endtime < t)  lo = mid + 1;
+    else  hi = mid;
+  }
+  return lo;
+}
+
 // convert absolute remainder (reference time 1970 01-01) to relative remainder (reference time today)
 // absolute remainder is stored in eeprom, relative remainder is presented to web
 void ProgramData::drem_to_relative(byte days[2]) {
@@ -30,6 +30,20 @@ prog_uchar htmlOkHeader[] PROGMEM =
 "\r\n"
 ;
 
+prog_uchar htmlJSONHeader[] PROGMEM = 
+"HTTP/1.0 200 OK\r\n"
+"Content-Type: application/json\r\n"
+"Pragma: no-cache\r\n"
+"\r\n"
+;
+
+prog_uchar htmlTextHeader[] PROGMEM = 
+"HTTP/1.0 200 OK\r\n"
+"Content-Type: text/plain\r\n"
+"Pragma: no-cache\r\n"
+"\r\n"
+;
+
 prog_uchar htmlMobileHeader[] PROGMEM =
 "<meta name=viewport content=\"width=640\">\r\n"
 ;
@@ -45,6 +59,34 @@ prog_uchar htmlReturnHome[] PROGMEM =
 "window.location=\"/\";</script>\n"
 ;
 
+prog_uchar htmlBadRequest[] PROGMEM = 
+"HTTP/1.0 400 Bad Request\r\n"
+"Content-Type: text/html\r\n"
+"\r\n"
+"<h1>400 Bad Request</h1>"
+;
+
+prog_uchar htmlNotFound[] PROGMEM = 
+"HTTP/1.0 404 Not Found\r\n"
+"Content-Type: text/html\r\n"
+"\r\n"
+"<h1>404 Not Found</h1>"
+;
+
+prog_uchar htmlTooLarge[] PROGMEM = 
+"HTTP/1.0 413 Request Entity Too Large\r\n"
+"Content-Type: text/html\r\n"
+"\r\n"
+"<h1>413 Request Entity Too Large</h1>"
+;
+
+prog_uchar htmlNotImplemented[] PROGMEM = 
+"HTTP/1.0 501 Not Implemented\r\n"
+"Content-Type: text/html\r\n"
+"\r\n"
+"<h1>501 Not Implemented</h1>"
+;
+
 /*prog_uchar htmlFavicon[] PROGMEM = 
  "HTTP/1.0 301 Moved Permanently\r\nLocation: "
  "http://rayshobby.net/rayshobby.ico"
@@ -53,15 +95,25 @@ prog_uchar htmlReturnHome[] PROGMEM =
  ;*/
 
 // check and verify password
-boolean check_password(char *p)
+boolean check_password()
 {
   if (svc.options[OPTION_IGNORE_PASSWORD].value)  return true;
-  if (!ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "pw") || !svc.password_verify(tmp_buffer)) {
+  char *pw = ether.queryValue("pw");
+  if (pw == NULL || !svc.password_verify(pw)) {
     return false;
   }
   return true;
 }
 
+// copy a query value to tmp_buffer, cut to the scratch buffer size
+// (for setters that write past the end of the string they are given)
+char* query_copy(const char *v)
+{
+  strncpy(tmp_buffer, v, TMP_BUFFER_SIZE);
+  tmp_buffer[TMP_BUFFER_SIZE] = 0;
+  return tmp_buffer;
+}
+
 // fill buffer with station names
 void bfill_station_names()
 {
@@ -101,20 +153,18 @@ boolean print_webpage_station_names(char *p) {
 // server function for accepting station name changes
 boolean print_webpage_change_stations(char *p)
 {
-  p+=3;
-
   // check password
-  if(check_password(p)==false)  return false;
+  if(check_password()==false)  return false;
 
   byte sid,bid;
-  char tbuf2[4] = {
-    's', 0, 0, 0  };
+  char *v;
+  char tbuf2[5] = {
+    's', 0, 0, 0, 0  };
   // process station names
   for(sid=0;sid<svc.nstations;sid++) {
     itoa(sid, tbuf2+1, 10);
-    if(ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, tbuf2)) {
-      ether.urlDecode(tmp_buffer);
-      svc.set_station_name(sid, tmp_buffer);
+    if((v = ether.queryValue(tbuf2)) != NULL) {
+      svc.set_station_name(sid, query_copy(v));
     }
   }
 
@@ -122,8 +172,8 @@ boolean print_webpage_change_stations(char *p)
   tbuf2[0]='m';
   for(bid=0;bid<svc.nboards;bid++) {
     itoa(bid, tbuf2+1, 10);
-    if(ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, tbuf2)) {
-      svc.masop_bits[bid] = atoi(tmp_buffer);
+    if((v = ether.queryValue(tbuf2)) != NULL) {
+      svc.masop_bits[bid] = atoi(v);
     }
   }
   svc.masop_save();
@@ -132,56 +182,36 @@ boolean print_webpage_change_stations(char *p)
   return true;
 }
 
-// split program data to subsections in order
-// to fit each subsection in a single http buffer
-#define PROGRAMDATA_SUBSECTION_SIZE  8
-
-// fill program data subsection
-void bfill_programdata_sub(byte start_index)
+// fill buffer with the fields of one program, comma separated,
+// with the station bits of the first nb boards
+void bfill_program(ProgramStruct *prog, byte nb)
 {
-  byte pid, bid;
-  ProgramStruct prog;    
-  for(pid=start_index; pid<start_index+PROGRAMDATA_SUBSECTION_SIZE && pid<pd.nprograms; pid++) {
-    pd.read(pid, &prog);
+  // convert interval remainder (absolute->relative)
+  if (prog->days[1] > 1)  pd.drem_to_relative(prog->days);
 
-    // convert interval remainder (absolute->relative)
-    if (prog.days[1] > 1)  pd.drem_to_relative(prog.days);
-
-    bfill.emit_p(PSTR("pd[$D]=[$D,$D,$D,$D,$D,$D,$D"), pid, prog.enabled, 
-    prog.days[0], prog.days[1], prog.start_time, prog.end_time, prog.interval, prog.duration);
-    for (bid=0; bid<svc.nboards; bid++) {
-      bfill.emit_p(PSTR(",$D"),prog.stations[bid]);
-    }
-    bfill.emit_p(PSTR("];"));
+  bfill.emit_p(PSTR("$D,$D,$D,$D,$D,$D,$D"), prog->enabled,
+  prog->days[0], prog->days[1], prog->start_time, prog->end_time, prog->interval, prog->duration);
+  for (byte bid=0; bid<nb; bid++) {
+    bfill.emit_p(PSTR(",$D"), prog->stations[bid]);
   }
 }
 
-// Javascript for printing program data subsection page
-boolean print_webpage_programdata_subsection(char *p) {
-  p+=2;
-  ether.urlDecode(p);
-
-  byte ssid = ((*p)-'0')*PROGRAMDATA_SUBSECTION_SIZE;
-  bfill.emit_p(PSTR("$F"), htmlOkHeader);
-  bfill_programdata_sub(ssid);
-  return true;
-}
-
 // fill buffer with program data
+// (bfill flushes to the client as it goes, so all programs fit in one page)
 void bfill_programdata()
 {
-  byte ssid;
+  byte pid;
+  ProgramStruct prog;    
 
   bfill.emit_p(PSTR("var nprogs=$D,nboards=$D,ipas=$D,mnp=$D,pd=[];"),
-  pd.nprograms, svc.nboards,svc.options[OPTION_IGNORE_PASSWORD].value, MAX_NUMBER_PROGRAMS);
-  bfill_programdata_sub(0);
-  bfill.emit_p(PSTR("</script>\n"));
-  if (pd.nprograms > PROGRAMDATA_SUBSECTION_SIZE) {
-    // create subsection pages
-    for (ssid=1; ssid<=((pd.nprograms-1)/PROGRAMDATA_SUBSECTION_SIZE); ssid++) {
-      bfill.emit_p(PSTR("<script src=ps$D.js></script>\n"), ssid);
-    }
+  pd.nprograms, svc.nboards,svc.options[OPTION_IGNORE_PASSWORD].value, pd.nslots);
+  for(pid=0; pid<pd.nprograms; pid++) {
+    pd.read(pid, &prog);
+    bfill.emit_p(PSTR("pd[$D]=["), pid);
+    bfill_program(&prog, svc.nboards);
+    bfill.emit_p(PSTR("];"));
   }
+  bfill.emit_p(PSTR("</script>\n"));
 }
 
 // webpage for printing run-once program
@@ -206,35 +236,25 @@ boolean print_webpage_view_runonce(char *str) {
 
 // server function to accept run-once program
 boolean print_webpage_change_runonce(char *p) {
-  p+=3;
-  ether.urlDecode(p);
-
   // check password
-  if(check_password(p)==false)  return false;
-
-  // search for the start of v=[
-  char *pv;
-  boolean found=false;
-  for(pv=p;(*pv)!=0 && pv<p+100;pv++) {
-    if(strncmp(pv, "t=[", 3)==0) {
-      found=true;
-      break;
-    }
-  }
-  if(!found)  return false;
-  pv+=3;
+  if(check_password()==false)  return false;
+
+  // the list comes as t=[...]
+  char *pv = ether.queryValue("t");
+  if(pv==NULL || pv[0]!='[')  return false;
+  pv++;
 
   // reset all stations and prepare to run one-time program
   reset_all_stations();
 
   byte sid;
   uint16_t dur;
-  unsigned char *addr = (unsigned char*)ADDR_EEPROM_RUNONCE;
+  unsigned int addr = ADDR_EEPROM_RUNONCE;
   boolean match_found = false;
   for(sid=0;sid<svc.nstations;sid++, addr+=2) {
     dur=parse_listdata(&pv);
-    eeprom_write_byte(addr, (dur>>8));
-    eeprom_write_byte(addr+1, (dur&0xff));
+    byte d[2] = {(byte)(dur>>8), (byte)(dur&0xff)};
+    svc.eeprom_put(addr, d, 2);
     if (dur>0) {
       pd.scheduled_stop_time[sid] = dur;
       pd.scheduled_program_index[sid] = 254;      
@@ -265,28 +285,19 @@ boolean print_webpage_view_program(char *str) {
 
 // webpage for printing program modification page 
 boolean print_webpage_modify_program(char *p) {
-  p+=3;
-  ether.urlDecode(p);
-
-  if (!ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "pid")) {
+  char *v = ether.queryValue("pid");
+  if (v == NULL) {
     return false;
   }
-  int pid=atoi(tmp_buffer);
+  int pid=atoi(v);
   if (!(pid>=-1 && pid< pd.nprograms)) return false;
   bfill.emit_p(PSTR("$F$F"), htmlOkHeader, htmlMobileHeader);
   bfill.emit_p(PSTR("<script>var nboards=$D,pid=$D,ipas=$D;"), svc.nboards, pid, svc.options[OPTION_IGNORE_PASSWORD].value);
   if(pid>-1) {
     ProgramStruct prog;
     pd.read(pid, &prog);
-
-    // process interval day remainder (absolute->relative)
-    if (prog.days[1] > 1)  pd.drem_to_relative(prog.days);
-
-    bfill.emit_p(PSTR("var prog=[$D,$D,$D,$D,$D,$D,$D"), prog.enabled,
-    prog.days[0], prog.days[1], prog.start_time, prog.end_time, prog.interval, prog.duration);
-    for(byte bid=0;bid<svc.nboards;bid++) {
-      bfill.emit_p(PSTR(",$D"), prog.stations[bid]);
-    }
+    bfill.emit_p(PSTR("var prog=["));
+    bfill_program(&prog, svc.nboards);
     bfill.emit_p(PSTR("];"));
   }
   // print station names
@@ -306,16 +317,14 @@ boolean print_webpage_modify_program(char *p) {
  =============================================*/
 boolean print_webpage_delete_program(char *p) {
 
-  p+=3;
-  ether.urlDecode(p);
-
   // check password
-  if(check_password(p)==false)  return false;
+  if(check_password()==false)  return false;
 
-  if (!ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "pid"))
+  char *v = ether.queryValue("pid");
+  if (v == NULL)
     return false;
 
-  int pid=atoi(tmp_buffer);
+  int pid=atoi(v);
   if (pid == -1) {
     pd.erase();
   } 
@@ -343,8 +352,6 @@ boolean print_webpage_delete_program(char *p) {
  date/month/year)
  =============================================*/
 boolean print_webpage_plot_program(char *p) {
-  p+=3;
-  ether.urlDecode(p);
 
   // yy,mm,dd are simulated date for graphical view
   // devdd is the device day
@@ -356,15 +363,16 @@ boolean print_webpage_plot_program(char *p) {
   devday = t/SECS_PER_DAY;  
   devmin = hour(t)*60+minute(t);
 
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "d")) {
-    dd=atoi(tmp_buffer);
+  char *v;
+  if ((v = ether.queryValue("d")) != NULL) {
+    dd=atoi(v);
     if (dd==0)  dd=day(t);
   }
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "m")) {
-    mm=atoi(tmp_buffer);
+  if ((v = ether.queryValue("m")) != NULL) {
+    mm=atoi(v);
   }
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "y")) {
-    yy=atoi(tmp_buffer);
+  if ((v = ether.queryValue("y")) != NULL) {
+    yy=atoi(v);
   }
 
   bfill.emit_p(PSTR("$F<script>var seq=$D,mas=$D,wl=$D,sdt=$D,mton=$D,mtoff=$D,devday=$D,devmin=$D,dd=$D,mm=$D,yy=$D;"),
@@ -402,48 +410,25 @@ uint16_t parse_listdata(char **p) {
 // server function to accept program changes
 boolean print_webpage_change_program(char *p) {
 
-  p+=3;
-  ether.urlDecode(p);
-
   // check password
-  if(check_password(p)==false)  return false;
+  if(check_password()==false)  return false;
 
   // parse program index
-  if (!ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "pid")) {
+  char *pv = ether.queryValue("pid");
+  if (pv == NULL) {
     return false;
   }
-  int pid=atoi(tmp_buffer);
+  int pid=atoi(pv);
   if (!(pid>=-1 && pid< pd.nprograms)) return false;
 
   // parse program data
   ProgramStruct prog;
 
-  // search for the start of v=[
-  char *pv;
-  boolean found=false;
-  for(pv=p;(*pv)!=0 && pv<p+100;pv++) {
-    if(strncmp(pv, "v=[", 3)==0) {
-      found=true;
-      break;
-    }
-  }
-  if(!found)  return false;
-  pv+=3;
-  // parse data field
-  prog.enabled = parse_listdata(&pv);
-  prog.days[0]= parse_listdata(&pv);
-  prog.days[1]= parse_listdata(&pv);
-  prog.start_time = parse_listdata(&pv);
-  prog.end_time = parse_listdata(&pv);
-  prog.interval = parse_listdata(&pv);
-  prog.duration = parse_listdata(&pv);
-
-  byte bid;
-  for(bid=0;bid<svc.nboards;bid++) {
-    prog.stations[bid] = parse_listdata(&pv);
-  }
-  for(;bid<MAX_EXT_BOARDS+1;bid++) {
-    prog.stations[bid] = 0;     // clear unused field
+  // the data comes as v=[...], checked as /ip checks each program
+  pv = ether.queryValue("v");
+  if (pv == NULL || !parse_program(&pv, &prog, svc.nboards) || *pv != 0) {
+    bfill.emit_p(PSTR("$F"), htmlBadRequest);
+    return true;
   }
 
   // process interval day remainder (relative-> absolute)
@@ -463,6 +448,154 @@ boolean print_webpage_change_program(char *p) {
   return true;
 }
 
+/*=============================================
+ Bulk program export / import
+ 
+ HTTP GET command format:
+ /ep  -> all programs as a form body: nb=x&v=[[...],[...],...]
+ 
+ HTTP POST (or GET) command format:
+ /ip?pw=xxx&nb=x&v=[[...],[...],...]
+ 
+ pw:  password
+ nb:  number of boards the station bits are listed for
+ v:   programs, each in the list format of /cp; they replace all existing programs
+ 
+ Cloning a controller takes a GET of /ep from one and a POST
+ of the result (with pw added) to /ip on the other.
+ =============================================*/
+#define PROGRAMS_INVALID  0xFF
+
+boolean print_webpage_export_programs(char *p)
+{
+  ProgramStruct prog;
+  byte pid, bid, nb = 1;
+  // list only as many boards as the programs use, to keep the export
+  // small enough to be posted back to /ip in one request
+  for(pid=0; pid<pd.nprograms; pid++) {
+    pd.read(pid, &prog);
+    for(bid=nb; bid<svc.nboards; bid++) {
+      if (prog.stations[bid])  nb = bid+1;
+    }
+  }
+  bfill.emit_p(PSTR("$Fnb=$D&v=["), htmlTextHeader, nb);
+  for(pid=0; pid<pd.nprograms; pid++) {
+    pd.read(pid, &prog);
+    bfill.emit_p(pid ? PSTR(",[") : PSTR("["));
+    bfill_program(&prog, nb);
+    bfill.emit_p(PSTR("]"));
+  }
+  bfill.emit_p(PSTR("]"));
+  return true;
+}
+
+// parse one program of the form [en,d0,d1,start,end,interval,duration,s0,s1,...]
+// with nb station bytes; false if it is malformed or a field is out of range
+boolean parse_program(char **p, ProgramStruct *prog, byte nb)
+{
+  byte i, n = 7+nb;
+  unsigned long v;
+  if (**p != '[')  return false;
+  (*p)++;
+  for (i=0; i<n; i++) {
+    parse_listdata(p);
+    if (tmp_buffer[0]<'0' || tmp_buffer[0]>'9' || (*p)[-1] != (i<n-1 ? ',' : ']'))  return false;
+    v = atol(tmp_buffer);
+    if (v > (i==0 ? 1 : (i<3 || i>6) ? 255 : (i<6) ? 1439 : 65535))  return false;
+    if (i==0)       prog->enabled = v;
+    else if (i<3)   prog->days[i-1] = v;
+    else if (i==3)  prog->start_time = v;
+    else if (i==4)  prog->end_time = v;
+    else if (i==5)  prog->interval = v;
+    else if (i==6)  prog->duration = v;
+    else            prog->stations[i-7] = v;
+  }
+  for (i=nb; i<MAX_EXT_BOARDS+1; i++) {
+    prog->stations[i] = 0;     // clear unused field
+  }
+  // interval day remainder must be less than the interval
+  if ((prog->days[0]&0x80) && prog->days[1]>1 && (prog->days[0]&0x7f) >= prog->days[1])  return false;
+  return true;
+}
+
+// walk a program list, returning the number of programs in it (or
+// PROGRAMS_INVALID); with store set the programs are also written out
+byte parse_program_list(char *pv, byte nb, boolean store)
+{
+  ProgramStruct prog;
+  byte n = 0;
+  if (pv == NULL || *pv++ != '[')  return PROGRAMS_INVALID;
+  if (*pv != ']') {
+    for(;;) {
+      if (n >= pd.nslots || !parse_program(&pv, &prog, nb))  return PROGRAMS_INVALID;
+      if (store) {
+        // process interval day remainder (relative-> absolute)
+        if (prog.days[1] > 1)  pd.drem_to_absolute(prog.days);
+        pd.bulk_write(n, &prog);
+      }
+      n++;
+      if (*pv == ']')  break;
+      if (*pv++ != ',')  return PROGRAMS_INVALID;
+    }
+  }
+  return (pv[1] == 0) ? n : PROGRAMS_INVALID;
+}
+
+boolean print_webpage_import_programs(char *p)
+{
+  // check password
+  if(check_password()==false)  return false;
+
+  char *pv = ether.queryValue("nb");
+  byte nb = pv ? atoi(pv) : svc.nboards;
+  pv = ether.queryValue("v");
+
+  // validate the whole list before any of it is written
+  if (nb < 1 || nb > MAX_EXT_BOARDS+1 ||
+      parse_program_list(pv, nb, false) == PROGRAMS_INVALID) {
+    bfill.emit_p(PSTR("$F"), htmlBadRequest);
+    return true;
+  }
+
+  pd.bulk_begin();
+  byte n = parse_program_list(pv, nb, true);
+  pd.bulk_end(n);
+
+  bfill.emit_p(PSTR("$F<script>alert(\"$D programs imported.\");window.location=\"/vp\";</script>\n"), htmlOkHeader, n);
+  return true;
+}
+
+// seconds left to run for a station (or its run time if it has not started)
+unsigned long station_remaining(byte sid, unsigned long curr_time)
+{
+  unsigned long rem = 0;
+  if (pd.scheduled_program_index[sid] > 0) {
+    rem = (curr_time >= pd.scheduled_start_time[sid]) ? (pd.scheduled_stop_time[sid]-curr_time) : (pd.scheduled_stop_time[sid]-pd.scheduled_start_time[sid]);
+    if(pd.scheduled_stop_time[sid]==ULONG_MAX-1)  rem=0;
+  }
+  return rem;
+}
+
+// find the next program run; returns the program index + 1
+// (0 if nothing is scheduled) and its start time in nrun_time
+byte find_next_run(unsigned long curr_time, time_t *nrun_time)
+{
+  ProgramStruct prog;
+  byte pid, nrun_pid = 0;
+  time_t t;
+  *nrun_time = 0;
+  for(pid=0;pid<pd.nprograms;pid++) {
+    pd.read(pid, &prog);
+    if (prog.duration == 0)  continue;
+    t = prog.next_match(curr_time);
+    if (t && (*nrun_time == 0 || t < *nrun_time)) {
+      *nrun_time = t;
+      nrun_pid = pid+1;
+    }
+  }
+  return nrun_pid;
+}
+
 // print home page
 boolean print_webpage_home(char *p)
 {
@@ -476,12 +609,7 @@ boolean print_webpage_home(char *p)
     bfill.emit_p(PSTR("$D,"), svc.station_bits[bid]);
   bfill.emit_p(PSTR("0];var ps=["));
   for(sid=0;sid<svc.nstations;sid++) {
-    unsigned long rem = 0;
-    if (pd.scheduled_program_index[sid] > 0) {
-      rem = (curr_time >= pd.scheduled_start_time[sid]) ? (pd.scheduled_stop_time[sid]-curr_time) : (pd.scheduled_stop_time[sid]-pd.scheduled_start_time[sid]);
-      if(pd.scheduled_stop_time[sid]==ULONG_MAX-1)  rem=0;
-    }
-    bfill.emit_p(PSTR("[$D,$L],"), pd.scheduled_program_index[sid], rem);
+    bfill.emit_p(PSTR("[$D,$L],"), pd.scheduled_program_index[sid], station_remaining(sid, curr_time));
   } 
   //svc.location_get(tmp_buffer);
   svc.eeprom_string_get(ADDR_EEPROM_LOCATION, tmp_buffer);
@@ -498,8 +626,13 @@ boolean print_webpage_home(char *p)
     tmp_buffer
   );
   
-  bfill.emit_p(PSTR("\nvar lrun=[$D,$D,$D,$L]</script>\n"),
+  bfill.emit_p(PSTR("\nvar lrun=[$D,$D,$D,$L]"),
   pd.lastrun.station, pd.lastrun.program,pd.lastrun.duration,pd.lastrun.endtime); // print station names
+
+  // find the next program run
+  time_t nrun_time;
+  byte nrun_pid = find_next_run(curr_time, &nrun_time);
+  bfill.emit_p(PSTR(",nrun=[$D,$L]</script>\n"), nrun_pid, nrun_time);
   
   bfill.emit_p(PSTR("<script src=\"pn.js\"></script>\n")); // include remote javascript
   bfill.emit_p(PSTR("<script src=\"$F/home.js\"></script>\n"), htmlExtJavascriptPath);
@@ -548,40 +681,40 @@ boolean print_webpage_view_options(char *p)
  =============================================*/
 boolean print_webpage_change_values(char *p)
 {
-  p+=3;
   // if no password is attached, or password is incorrect
-  if(check_password(p)==false)  return false;
+  if(check_password()==false)  return false;
 
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "rsn")) {
+  char *v;
+  if (ether.queryValue("rsn")) {
     reset_all_stations();
   }
 #define TIME_REBOOT_DELAY  10
 
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "rbt") && atoi(tmp_buffer) > 0) {
+  if ((v = ether.queryValue("rbt")) != NULL && atoi(v) > 0) {
     bfill.emit_p(PSTR("$F<meta http-equiv=\"refresh\" content=\"$D; url=/\">"), htmlOkHeader, TIME_REBOOT_DELAY);
     bfill.emit_p(PSTR("Rebooting..."));
     ether.httpServerReply(bfill.position());   
     svc.reboot();
   } 
 
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "en")) {
-    if (tmp_buffer[0]=='1' && !svc.status.enabled)  svc.enable();
-    else if (tmp_buffer[0]=='0' &&  svc.status.enabled)  svc.disable();
+  if ((v = ether.queryValue("en")) != NULL) {
+    if (v[0]=='1' && !svc.status.enabled)  svc.enable();
+    else if (v[0]=='0' &&  svc.status.enabled)  svc.disable();
   }   
 
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "mm")) {
-    if (tmp_buffer[0]=='1' && !svc.status.manual_mode) {
+  if ((v = ether.queryValue("mm")) != NULL) {
+    if (v[0]=='1' && !svc.status.manual_mode) {
       reset_all_stations();
       svc.status.manual_mode = 1;
 
     } 
-    else if (tmp_buffer[0]=='0' &&  svc.status.manual_mode) {
+    else if (v[0]=='0' &&  svc.status.manual_mode) {
       reset_all_stations();
       svc.status.manual_mode = 0;
     }
   }
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "rd")) {
-    int rd = atoi(tmp_buffer);
+  if ((v = ether.queryValue("rd")) != NULL) {
+    int rd = atoi(v);
     if (rd>0) {
       svc.raindelay_start(rd);
     } 
@@ -598,33 +731,32 @@ boolean print_webpage_change_values(char *p)
 // server function to accept option changes
 boolean print_webpage_change_options(char *p)
 {
-  p+=3;
-
   // if no password is attached, or password is incorrect
-  if(check_password(p)==false)  return false;
+  if(check_password()==false)  return false;
 
   // !!! p and bfill share the same buffer, so don't write
   // to bfill before you are done analyzing the buffer !!!
 
   // process option values
   byte err = 0;
+  char *v;
   for (byte oid=0; oid<NUM_OPTIONS; oid++) {
     if ((svc.options[oid].flag&OPFLAG_WEB_EDIT)==0) continue;
     if (svc.options[oid].max==1)  svc.options[oid].value = 0;  // set a bool variable to 0 first
     char tbuf2[5] = {
       'o', 0, 0, 0, 0    };
     itoa(oid, tbuf2+1, 10);
-    if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, tbuf2)) {
+    if ((v = ether.queryValue(tbuf2)) != NULL) {
       if (svc.options[oid].max==1) {
         svc.options[oid].value = 1;  // if the bool variable is detected, set to 1
         continue;
       }
-      int v = atoi(tmp_buffer);
+      int ov = atoi(v);
       if (oid==OPTION_MASTER_OFF_ADJ) {
-        v+=60;
+        ov+=60;
       } // master off time
-      if (v>=0 && v<=svc.options[oid].max) {
-        svc.options[oid].value = v;
+      if (ov>=0 && ov<=svc.options[oid].max) {
+        svc.options[oid].value = ov;
       } 
       else {
         err = 1;
@@ -632,10 +764,9 @@ boolean print_webpage_change_options(char *p)
     }
   }
 
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "loc")) {
-    ether.urlDecode(tmp_buffer);
+  if ((v = ether.queryValue("loc")) != NULL) {
     //svc.location_set(tmp_buffer);    
-    svc.eeprom_string_set(ADDR_EEPROM_LOCATION, tmp_buffer);
+    svc.eeprom_string_set(ADDR_EEPROM_LOCATION, query_copy(v));
   }
 
   if (err) {
@@ -643,13 +774,25 @@ boolean print_webpage_change_options(char *p)
     return true;
   } 
 
+  // fewer boards give smaller but more program slots, more boards
+  // give fewer: refuse a board count the programs do not fit in
+  byte nb = svc.options[OPTION_EXT_BOARDS].value+1;
+  if (pd.nprograms > PROGRAM_SLOTS(nb)) {
+    svc.options[OPTION_EXT_BOARDS].value = svc.nboards-1;
+    bfill.emit_p(PSTR("$F<script>alert(\"$D programs do not fit with $D boards, delete $D first.\");window.location=\"/vo\";</script>\n"),
+                 htmlOkHeader, pd.nprograms, nb, pd.nprograms-PROGRAM_SLOTS(nb));
+    return true;
+  }
+
   svc.options_save();
+  // resize the program slots if the number of boards has changed
+  pd.set_boards(svc.nboards);
 
-  if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "npw")) {
-    char tbuf2[TMP_BUFFER_SIZE];
-    if (ether.findKeyVal(p, tbuf2, TMP_BUFFER_SIZE, "cpw") && strncmp(tmp_buffer, tbuf2, 16) == 0) {
+  if ((v = ether.queryValue("npw")) != NULL) {
+    char *cpw = ether.queryValue("cpw");
+    if (cpw != NULL && strncmp(v, cpw, 16) == 0) {
       //svc.password_set(tmp_buffer);
-      svc.eeprom_string_set(ADDR_EEPROM_PASSWORD, tmp_buffer);
+      svc.eeprom_string_set(ADDR_EEPROM_PASSWORD, query_copy(v));
       bfill.emit_p(PSTR("$F<script>alert(\"New password set.\");$F"), htmlOkHeader, htmlReturnHome);
       return true;
     } 
@@ -709,8 +852,11 @@ boolean print_webpage_station_bits(char *p) {
     } 
     else if ((*p)=='1') {
       int ontimer = 0;
-      if (ether.findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, "t")) {
-        ontimer = atoi(tmp_buffer);
+      char *v;
+      // the rest (&t=xx) is not behind a '?', so index it here
+      ether.queryParse(p+1);
+      if ((v = ether.queryValue("t")) != NULL) {
+        ontimer = atoi(v);
         if (!(ontimer>=0))  return false;
       }
       manual_station_on((byte)sid, ontimer);
@@ -744,6 +890,208 @@ boolean print_webpage_station_bits(char *p) {
   return false;
 }
 
+/*=============================================
+ JSON API for machine clients
+ 
+ HTTP GET command format:
+ /jc  -> controller status
+ /jo  -> options (indexed by option id) and location
+ /jp  -> programs, with their ids
+ /jn  -> station names and master operation bits
+ /jl  -> last run, and the run log records that ended in a time range:
+         /jl?s=<start>&e=<end> (seconds, both optional)
+ /je  -> EEPROM bytes written, bytes skipped as unchanged, and
+         write stall time (ms) since boot, one entry per region
+ /jm  -> RAM use (bytes): sections, stack now and deepest since boot,
+         and the globals of each module
+ /jd  -> main loop stage timing (us): count, min, max, mean and a log2
+         histogram per stage (its counts are halved together whenever
+         one reaches 255, so they show shares); /jd?rs=1&pw=xxx
+         reports, then resets them
+ =============================================*/
+
+// fill buffer with a quoted json string
+void bfill_json_string(const char *s)
+{
+  bfill.write('"');
+  for (; *s; s++) {
+    if ((byte)(*s) < 0x20)  continue;
+    if (*s=='"' || *s=='\\')  bfill.write('\\');
+    bfill.write(*s);
+  }
+  bfill.write('"');
+}
+
+boolean print_json_controller(char *p)
+{
+  byte bid, sid;
+  unsigned long curr_time = now();
+  bfill.emit_p(PSTR("$F{\"fwv\":$D,\"devt\":$L,\"nbrd\":$D,\"en\":$D,\"rd\":$D,\"rs\":$D,\"mm\":$D,\"rdst\":$L,\"mas\":$D,\"urs\":$D,\"wl\":$D,\"sbits\":["),
+    htmlJSONHeader, SVC_FW_VERSION, curr_time, svc.nboards,
+    svc.status.enabled,
+    svc.status.rain_delayed,
+    svc.status.rain_sensed,
+    svc.status.manual_mode,
+    svc.raindelay_stop_time,
+    svc.options[OPTION_MASTER_STATION].value,
+    svc.options[OPTION_USE_RAINSENSOR].value,
+    svc.options[OPTION_WATER_LEVEL].value);
+  for(bid=0;bid<svc.nboards;bid++)
+    bfill.emit_p(bid ? PSTR(",$D") : PSTR("$D"), svc.station_bits[bid]);
+  bfill.emit_p(PSTR("],\"ps\":["));
+  for(sid=0;sid<svc.nstations;sid++) {
+    bfill.emit_p(sid ? PSTR(",[$D,$L]") : PSTR("[$D,$L]"), pd.scheduled_program_index[sid], station_remaining(sid, curr_time));
+  }
+  time_t nrun_time;
+  byte nrun_pid = find_next_run(curr_time, &nrun_time);
+  bfill.emit_p(PSTR("],\"lrun\":[$D,$D,$D,$L],\"nrun\":[$D,$L]}"),
+    pd.lastrun.station, pd.lastrun.program, pd.lastrun.duration, pd.lastrun.endtime, nrun_pid, nrun_time);
+  return true;
+}
+
+boolean print_json_options(char *p)
+{
+  bfill.emit_p(PSTR("$F{\"opts\":["), htmlJSONHeader);
+  for (byte oid=0; oid<NUM_OPTIONS; oid++) {
+    bfill.emit_p(oid ? PSTR(",$D") : PSTR("$D"),
+    (oid==OPTION_MASTER_OFF_ADJ)?(int)svc.options[oid].value-60:(int)svc.options[oid].value);
+  }
+  svc.eeprom_string_get(ADDR_EEPROM_LOCATION, tmp_buffer);
+  bfill.emit_p(PSTR("],\"loc\":"));
+  bfill_json_string(tmp_buffer);
+  bfill.emit_p(PSTR("}"));
+  return true;
+}
+
+boolean print_json_programs(char *p)
+{
+  ProgramStruct prog;
+  bfill.emit_p(PSTR("$F{\"nprogs\":$D,\"nboards\":$D,\"mnp\":$D,\"pd\":["), htmlJSONHeader,
+  pd.nprograms, svc.nboards, pd.nslots);
+  for(byte pid=0; pid<pd.nprograms; pid++) {
+    pd.read(pid, &prog);
+    bfill.emit_p(pid ? PSTR(",[") : PSTR("["));
+    bfill_program(&prog, svc.nboards);
+    bfill.emit_p(PSTR("]"));
+  }
+  // program ids (slots), which stay the same when other programs are deleted
+  bfill.emit_p(PSTR("],\"ids\":["));
+  for(byte pid=0; pid<pd.nprograms; pid++) {
+    bfill.emit_p(pid ? PSTR(",$D") : PSTR("$D"), pd.slot(pid));
+  }
+  bfill.emit_p(PSTR("]}"));
+  return true;
+}
+
+boolean print_json_station_names(char *p)
+{
+  bfill.emit_p(PSTR("$F{\"snames\":["), htmlJSONHeader);
+  for(byte sid=0;sid<svc.nstations;sid++) {
+    if (sid)  bfill.write(',');
+    svc.get_station_name(sid, tmp_buffer);
+    bfill_json_string(tmp_buffer);
+  }
+  bfill.emit_p(PSTR("],\"masop\":["));
+  for(byte bid=0;bid<svc.nboards;bid++) {
+    bfill.emit_p(bid ? PSTR(",$D") : PSTR("$D"), svc.masop_bits[bid]);
+  }
+  bfill.emit_p(PSTR("]}"));
+  return true;
+}
+
+boolean print_json_log(char *p)
+{
+  unsigned long start = 0, end = now();
+  char *v;
+  if ((v = ether.queryValue("s")) != NULL)  start = strtoul(v, NULL, 10);
+  if ((v = ether.queryValue("e")) != NULL)  end = strtoul(v, NULL, 10);
+  bfill.emit_p(PSTR("$F{\"lrun\":[$D,$D,$D,$L],\"nlogs\":$D,\"log\":["), htmlJSONHeader,
+  pd.lastrun.station, pd.lastrun.program, pd.lastrun.duration, pd.lastrun.endtime, pd.nlogs);
+  // merge the matches of the two runs of the log (see log_find),
+  // so the records come out in time order
+  LogStruct rec[2];
+  unsigned int k[2];
+  boolean first = true;
+  byte r;
+  for (r=0; r<2; r++) {
+    k[r] = pd.log_find(start, r);
+    if (k[r] < pd.log_run_end(r))  pd.log_read(k[r], &rec[r]);
+  }
+  for (;;) {
+    boolean in0 = k[0] < pd.log_run_end(0) && rec[0].endtime <= end;
+    boolean in1 = k[1] < pd.log_run_end(1) && rec[1].endtime <= end;
+    if (!in0 && !in1)  break;
+    r = (in0 && (!in1 || rec[0].endtime <= rec[1].endtime)) ? 0 : 1;
+    bfill.emit_p(first ? PSTR("[$D,$D,$D,$L]") : PSTR(",[$D,$D,$D,$L]"),
+    rec[r].station, rec[r].program, rec[r].duration, rec[r].endtime);
+    first = false;
+    if (++k[r] < pd.log_run_end(r))  pd.log_read(k[r], &rec[r]);
+  }
+  bfill.emit_p(PSTR("]}"));
+  return true;
+}
+
+boolean print_json_eeprom(char *p)
+{
+  byte i;
+  bfill.emit_p(PSTR("$F{\"upt\":$L,\"regions\":[\"options\",\"password\",\"location\",\"snames\",\"runonce\",\"masop\",\"programs\",\"log\"],\"writes\":["),
+    htmlJSONHeader, millis()/1000);
+  for(i=0;i<NUM_EEPROM_REGIONS;i++)
+    bfill.emit_p(i ? PSTR(",$L") : PSTR("$L"), svc.eeprom_stats[i].writes);
+  bfill.emit_p(PSTR("],\"skipped\":["));
+  for(i=0;i<NUM_EEPROM_REGIONS;i++)
+    bfill.emit_p(i ? PSTR(",$L") : PSTR("$L"), svc.eeprom_stats[i].skipped);
+  bfill.emit_p(PSTR("],\"stall\":["));
+  for(i=0;i<NUM_EEPROM_REGIONS;i++)
+    bfill.emit_p(i ? PSTR(",$L") : PSTR("$L"), svc.eeprom_stats[i].stall_us/1000);
+  bfill.emit_p(PSTR("]}"));
+  return true;
+}
+
+boolean print_json_memory(char *p)
+{
+  RamMap m;
+  svc.ram_map(&m);
+  unsigned int mods = sizeof(EtherCard::buffer) + (TMP_BUFFER_SIZE+1) + svc.ram_size() + pd.ram_size();
+  bfill.emit_p(PSTR("$F{\"data\":$D,\"bss\":$D,\"heap\":$D,\"stack\":$D,\"stackmax\":$D,\"free\":$D,\"margin\":$D,"),
+    htmlJSONHeader, m.data, m.bss, m.heap, m.stack, m.stack_max, m.free, m.margin);
+  bfill.emit_p(PSTR("\"globals\":{\"ether\":$D,\"tmp\":$D,\"svc\":$D,\"pd\":$D,\"other\":$D}}"),
+    sizeof(EtherCard::buffer), TMP_BUFFER_SIZE+1, svc.ram_size(), pd.ram_size(), m.data+m.bss-mods);
+  return true;
+}
+
+boolean print_json_diagnostics(char *p)
+{
+  byte i, b;
+  boolean reset = (ether.queryValue("rs") != NULL);
+  if (reset && check_password()==false)  return false;
+  bfill.emit_p(PSTR("$F{\"upt\":$L,\"stages\":[\"loop\",\"packets\",\"buttons\",\"schedule\",\"runner\",\"outputs\",\"lcd\",\"network\",\"ntp\"],\"n\":["),
+    htmlJSONHeader, millis()/1000);
+  for(i=0;i<NUM_PROBES;i++)
+    bfill.emit_p(i ? PSTR(",$L") : PSTR("$L"), svc.probes[i].count);
+  bfill.emit_p(PSTR("],\"min\":["));
+  for(i=0;i<NUM_PROBES;i++)
+    bfill.emit_p(i ? PSTR(",$L") : PSTR("$L"), svc.probes[i].min_us);
+  bfill.emit_p(PSTR("],\"max\":["));
+  for(i=0;i<NUM_PROBES;i++)
+    bfill.emit_p(i ? PSTR(",$L") : PSTR("$L"), svc.probes[i].max_us);
+  bfill.emit_p(PSTR("],\"mean\":["));
+  for(i=0;i<NUM_PROBES;i++)
+    bfill.emit_p(i ? PSTR(",$L") : PSTR("$L"),
+      svc.probes[i].total_n ? svc.probes[i].total_us / svc.probes[i].total_n : 0);
+  // bucket 0: below 16us, bucket b: from 2^(b+3)us
+  bfill.emit_p(PSTR("],\"hist\":["));
+  for(i=0;i<NUM_PROBES;i++) {
+    bfill.emit_p(i ? PSTR(",[") : PSTR("["));
+    for(b=0;b<PROBE_BUCKETS;b++)
+      bfill.emit_p(b ? PSTR(",$D") : PSTR("$D"), svc.probes[i].hist[b]);
+    bfill.emit_p(PSTR("]"));
+  }
+  bfill.emit_p(PSTR("]}"));
+  if (reset)  svc.probes_reset();
+  return true;
+}
+
 /*boolean print_webpage_favicon()
  {
  bfill.emit_p(PSTR("$F"), htmlFavicon);
@@ -754,133 +1102,161 @@ boolean print_webpage_station_bits(char *p) {
 // NTP Functions
 // =============
 
-unsigned long ntp_wait_response()
+// check for an answer to the last NTP request without waiting;
+// returns the local time, or 0 if nothing has arrived yet
+unsigned long ntp_check_response()
 {
   uint32_t time;
-  unsigned long start = millis();
-  do {
-    ether.packetLoop(ether.packetReceive());
-    if (ether.ntpProcessAnswer(&time, ntpclientportL))
-    {
-      if ((time & 0x80000000UL) ==0){
-        time+=2085978496;
-      }
-      else{
-        time-=2208988800UL;
-      }
-      return time + (int32_t)3600/4*(int32_t)(svc.options[OPTION_TIMEZONE].value-48);
+  if (ether.ntpProcessAnswer(&time, ntpclientportL))
+  {
+    if ((time & 0x80000000UL) ==0){
+      time+=2085978496;
     }
-  } 
-  while(millis() - start < 1000); // wait at most 1 seconds for ntp result
+    else{
+      time-=2208988800UL;
+    }
+    return time + (int32_t)3600/4*(int32_t)(svc.options[OPTION_TIMEZONE].value-48);
+  }
   return 0;
 }
-unsigned long getNtpTime()
-{
-  unsigned long ans;
-  byte tick = 0;
-  do
-  {
-    ether.ntpRequest(ntpip, ++ntpclientportL);
-    delay(250);
-    ans = ntp_wait_response();
-    tick ++;
-  } 
-  while( ans == 0 && tick < 5 );  
-  return ans;
-}
-
-struct URLStruct{
-  PGM_P PROGMEM url;
-  boolean (*handler)(char*);
-};
-
-// Server function urls
-// !!!Important!!!: to save space, each url must be two characters long
-prog_char _url_cv [] PROGMEM = "cv";
-prog_char _url_vp [] PROGMEM = "vp";
-prog_char _url_mp [] PROGMEM = "mp";
-prog_char _url_dp [] PROGMEM = "dp";
-prog_char _url_cp [] PROGMEM = "cp";
-prog_char _url_gp [] PROGMEM = "gp";
-prog_char _url_vo [] PROGMEM = "vo";
-prog_char _url_co [] PROGMEM = "co";
-prog_char _url_sn [] PROGMEM = "sn";
-prog_char _url_ps [] PROGMEM = "ps";
-prog_char _url_vs [] PROGMEM = "vs";
-prog_char _url_cs [] PROGMEM = "cs";
-prog_char _url_vr [] PROGMEM = "vr";
-prog_char _url_cr [] PROGMEM = "cr";
-prog_char _url_pn [] PROGMEM = "pn";
-
-// Server function handlers
-URLStruct urls[] = {
-  {
-    _url_cv,print_webpage_change_values  }
-  ,
-  {
-    _url_vp,print_webpage_view_program  }
-  ,
-  {
-    _url_mp,print_webpage_modify_program  }
-  ,
-  {
-    _url_dp,print_webpage_delete_program  }
-  ,
-  {
-    _url_cp,print_webpage_change_program  }
-  ,
-  {
-    _url_gp,print_webpage_plot_program  }
-  ,
-  {
-    _url_vo,print_webpage_view_options  }
-  ,
-  {
-    _url_co,print_webpage_change_options  }
-  ,
-  {
-    _url_sn,print_webpage_station_bits  }
-  ,
-  {
-    _url_ps,print_webpage_programdata_subsection  }
-  ,
-  {
-    _url_vs,print_webpage_view_stations  }
-  ,
-  {
-    _url_cs,print_webpage_change_stations  }
-  ,
-  {
-    _url_vr,print_webpage_view_runonce  }
-  ,
-  {
-    _url_cr,print_webpage_change_runonce  }
-  ,
-  {
-    _url_pn,print_webpage_station_names  }
-};
+
+// HTTP methods accepted by the server
+#define HTTP_GET   1
+#define HTTP_POST  2
+
+byte http_method;   // method of the request being served
+
+// Switch label for a url path: its first two characters and whether the
+// path is shorter than, exactly, or longer than two characters. Cases for
+// paths longer than two characters compare the rest of the path themselves.
+#define URL_CODE(a,b,n)  ((uint16_t)((((a)&0x7F)<<9) | (((b)&0x7F)<<2) | (n)))
+#define URL2(a,b)        URL_CODE(a,b,2)
+#define URL_LONG(a,b)    URL_CODE(a,b,3)
 
 // analyze the current url
 void analyze_get_url(char *p)
 {
-  // the tcp packet usually starts with 'GET /' -> 5 chars    
-  char *str = p+5;
-
-  if(str[0]==' ') {
-    print_webpage_home(str);  // home page handler
-  } 
+  // the tcp packet starts with the method, e.g. 'GET /' -> 5 chars
+  char *str;
+  if (strncmp_P(p, PSTR("GET /"), 5)==0) {
+    http_method = HTTP_GET;
+    str = p+5;
+  }
+  else if (strncmp_P(p, PSTR("POST /"), 6)==0) {
+    http_method = HTTP_POST;
+    str = p+6;
+  }
   else {
-    for(byte i=0;i<15;i++) {
-      if(pgm_read_byte(urls[i].url)==str[0]
-        &&pgm_read_byte(urls[i].url+1)==str[1]) {
-        if ((urls[i].handler)(str) == false) {
-          bfill.emit_p(PSTR("$F"), htmlUnauthorized);
-        }
-        break;
-      }
-    }
+    bfill.emit_p(PSTR("$F"), htmlNotImplemented);
+    return;
+  }
+
+  // no handler gets a request that did not fit in the buffer
+  if (ether.requestTruncated()) {
+    bfill.emit_p(PSTR("$F"), htmlTooLarge);
+    return;
   }
-  delay(50); // add a bit of delay here
-}
 
+  // cut the request line after the url and index its query string,
+  // and for a POST the (form encoded) body as well
+  char *q = str;
+  while (*q && *q!=' ' && *q!='\r' && *q!='\n')  q++;
+  *q = 0;
+  q = strchr(str, '?');
+  if (q)  *q++ = 0;
+  ether.queryParse(q ? q : str+strlen(str));
+  if (http_method == HTTP_POST)  ether.queryParse(ether.requestBody(), true);
+
+  byte n = strlen(str);
+  boolean (*handler)(char*) = NULL;
+  switch (URL_CODE(str[0], n>1 ? str[1] : 0, n>3 ? 3 : n)) {
+  case 0:
+    handler = print_webpage_home;
+    break;
+  case URL2('c','v'):
+    handler = print_webpage_change_values;
+    break;
+  case URL2('v','p'):
+    handler = print_webpage_view_program;
+    break;
+  case URL2('m','p'):
+    handler = print_webpage_modify_program;
+    break;
+  case URL2('d','p'):
+    handler = print_webpage_delete_program;
+    break;
+  case URL2('c','p'):
+    handler = print_webpage_change_program;
+    break;
+  case URL2('g','p'):
+    handler = print_webpage_plot_program;
+    break;
+  case URL2('v','o'):
+    handler = print_webpage_view_options;
+    break;
+  case URL2('c','o'):
+    handler = print_webpage_change_options;
+    break;
+  case URL2('s','n'):
+    handler = print_webpage_station_bits;
+    break;
+  case URL_LONG('s','n'):     // /snx, /snx=y: a station index must follow
+    if (str[2]>='0' && str[2]<='9')  handler = print_webpage_station_bits;
+    break;
+  case URL2('v','s'):
+    handler = print_webpage_view_stations;
+    break;
+  case URL2('c','s'):
+    handler = print_webpage_change_stations;
+    break;
+  case URL2('v','r'):
+    handler = print_webpage_view_runonce;
+    break;
+  case URL2('c','r'):
+    handler = print_webpage_change_runonce;
+    break;
+  case URL2('p','n'):
+    handler = print_webpage_station_names;
+    break;
+  case URL_LONG('p','n'):     // also serves /pn.js
+    if (strcmp_P(str+2, PSTR(".js"))==0)  handler = print_webpage_station_names;
+    break;
+  case URL2('e','p'):
+    handler = print_webpage_export_programs;
+    break;
+  case URL2('i','p'):
+    handler = print_webpage_import_programs;
+    break;
+  case URL2('j','c'):
+    handler = print_json_controller;
+    break;
+  case URL2('j','o'):
+    handler = print_json_options;
+    break;
+  case URL2('j','p'):
+    handler = print_json_programs;
+    break;
+  case URL2('j','n'):
+    handler = print_json_station_names;
+    break;
+  case URL2('j','l'):
+    handler = print_json_log;
+    break;
+  case URL2('j','e'):
+    handler = print_json_eeprom;
+    break;
+  case URL2('j','m'):
+    handler = print_json_memory;
+    break;
+  case URL2('j','d'):
+    handler = print_json_diagnostics;
+    break;
+  }
 
+  if (handler == NULL) {
+    bfill.emit_p(PSTR("$F"), htmlNotFound);
+  }
+  else if (handler(str) == false) {
+    bfill.emit_p(PSTR("$F"), htmlUnauthorized);
+  }
+}